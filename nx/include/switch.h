@@ -62,6 +62,7 @@ extern "C" {
 #include "switch/services/ncm.h"
 
 #include "switch/gfx/gfx.h"
+#include "switch/gfx/gfx2d.h"
 #include "switch/gfx/binder.h"
 #include "switch/gfx/parcel.h"
 #include "switch/gfx/buffer_producer.h"
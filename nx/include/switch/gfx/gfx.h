@@ -24,6 +24,48 @@ typedef enum
 
 /// Framebuffer pixel-format is RGBA8888, there's no known way to change this.
 
+/// Timing of \ref gfxFlushBuffers, in system ticks (19.2 MHz).
+typedef struct
+{
+    u64 last_ticks;  ///< Duration of the last call.
+    u64 max_ticks;   ///< Duration of the longest call.
+    u64 total_ticks; ///< Total duration of all calls.
+    u64 count;       ///< Number of calls.
+} GfxFlushStats;
+
+/// Number of frames kept by the frame-timing ring buffer, see \ref gfxGetFrameTimings.
+#define GFX_FRAME_TIMINGS_MAX 128
+
+/// Per-frame durations recorded in \ref GfxFrameTiming.
+typedef enum
+{
+    GfxFrameTiming_Frame,   ///< Time between the start of the previous swap and the start of this one.
+    GfxFrameTiming_Flush,   ///< Time spent in \ref gfxFlushBuffers.
+    GfxFrameTiming_Queue,   ///< Time spent queueing the framebuffer for display.
+    GfxFrameTiming_Dequeue, ///< Time spent dequeueing the next framebuffer, excluding the fence wait.
+    GfxFrameTiming_Fence,   ///< Time spent waiting for the next framebuffer to be released.
+    GfxFrameTiming_Vsync,   ///< Time spent in \ref gfxWaitForVsync.
+
+    GfxFrameTiming_Count,   ///< Number of durations.
+} GfxFrameTimingType;
+
+/// Timing of a single frame, in system ticks (19.2 MHz). A frame ends with \ref gfxSwapBuffers or \ref gfxSwapBuffersNonBlocking.
+typedef struct
+{
+    u64 timestamp;                     ///< System tick at the start of the swap ending the frame.
+    u64 ticks[GfxFrameTiming_Count];   ///< Durations, indexed by \ref GfxFrameTimingType.
+} GfxFrameTiming;
+
+/// Statistics for one \ref GfxFrameTimingType over the frames in the ring buffer, in system ticks.
+typedef struct
+{
+    u64 min; ///< Shortest duration.
+    u64 avg; ///< Average duration.
+    u64 p99; ///< 99th percentile duration.
+    u64 max; ///< Longest duration.
+    u32 count; ///< Number of frames the statistics cover.
+} GfxFrameTimingStats;
+
 /**
  * @brief Initializes the graphics subsystem.
  * @warning Do not use \ref viInitialize when using this function.
@@ -47,6 +89,14 @@ void gfxExit(void);
  */
 void gfxInitResolution(u32 width, u32 height);
 
+/**
+ * @brief Sets the number of framebuffers to be used when initializing the graphics subsystem.
+ * @param[in] count Number of framebuffers (2~3), the default is 2. Out-of-range values are clamped.
+ * @note This can only be used before calling \ref gfxInitDefault, this will use \ref fatalSimple otherwise. The count is reset to the default when \ref gfxExit is used.
+ * @note With 3 framebuffers, one can be drawn while another one is displayed and the third one is queued, see \ref gfxSwapBuffersNonBlocking. The text-console (see console.h) only supports 2, \ref consoleInit uses \ref fatalSimple otherwise.
+ */
+void gfxConfigureFramebufferCount(u32 count);
+
 /// Wrapper for \ref gfxInitResolution with resolution=1080p. Use this if you want to support 1080p or >720p in docked-mode.
 void gfxInitResolutionDefault(void);
 
@@ -73,6 +123,9 @@ void gfxWaitForVsync(void);
 /// Swaps the framebuffers (for double-buffering).
 void gfxSwapBuffers(void);
 
+/// Same as \ref gfxSwapBuffers, except that waiting for the next framebuffer to be released is deferred until it's used by \ref gfxGetFramebuffer or \ref gfxFlushBuffers, so that the application can do non-drawing work meanwhile. Only the fence wait is deferred, dequeuing the next framebuffer can still block. This is most useful with 3 framebuffers, see \ref gfxConfigureFramebufferCount.
+void gfxSwapBuffersNonBlocking(void);
+
 /// Get the current framebuffer address, with optional output ptrs for the display framebuffer width/height. The display width/height is adjusted by \ref gfxConfigureCrop and \ref gfxConfigureResolution.
 u8* gfxGetFramebuffer(u32* width, u32* height);
 
@@ -85,6 +138,9 @@ size_t gfxGetFramebufferSize(void);
 /// Sets the \ref GfxMode.
 void gfxSetMode(GfxMode mode);
 
+/// Gets the current \ref GfxMode.
+GfxMode gfxGetMode(void);
+
 /// Controls whether a vertical-flip is done when determining the pixel-offset within the actual framebuffer. By default this is enabled.
 void gfxSetDrawFlip(bool flip);
 
@@ -94,6 +150,37 @@ void gfxConfigureTransform(u32 transform);
 /// Flushes the framebuffer in the data cache. When \ref GfxMode is GfxMode_LinearDouble, this also transfers the linear-framebuffer to the actual framebuffer.
 void gfxFlushBuffers(void);
 
+/**
+ * @brief Sets the number of worker threads which \ref gfxFlushBuffers uses in addition to the calling thread, 0 by default.
+ * @param num_threads Number of worker threads (0~3). They run on cores 1, 2 and 0, in that order.
+ * @note The frame is split into 128-row bands which are transferred and flushed in parallel. \ref gfxExit stops the threads.
+ * @return Result code.
+ */
+Result gfxConfigureFlushThreads(u32 num_threads);
+
+/// Retrieves the timing of \ref gfxFlushBuffers since \ref gfxInitDefault.
+void gfxGetFlushStats(GfxFlushStats *out);
+
+/**
+ * @brief Retrieves the timing of the most recent frames, oldest first.
+ * @param[out] out Output array.
+ * @param[in] max Maximum number of frames to retrieve, at most \ref GFX_FRAME_TIMINGS_MAX frames are kept.
+ * @return Number of frames written to the output array.
+ */
+u32 gfxGetFrameTimings(GfxFrameTiming *out, u32 max);
+
+/// Computes min/avg/p99/max over the frames in the frame-timing ring buffer for the specified \ref GfxFrameTimingType. All-zero when no frame was recorded.
+void gfxGetFrameTimingStats(GfxFrameTimingType type, GfxFrameTimingStats *out);
+
+/// Clears the frame-timing ring buffer. This is done automatically by \ref gfxInitDefault.
+void gfxResetFrameTimings(void);
+
+/// Enables or disables dirty-region tracking, disabled by default. When enabled, \ref gfxFlushBuffers only transfers (with GfxMode_LinearDouble) and flushes the 16x16 pixel blocks marked with \ref gfxMarkDirty since the current framebuffer was last flushed.
+void gfxSetDirtyTracking(bool enable);
+
+/// Marks a region of the framebuffer as modified, in the coordinates used for drawing. Only used when dirty-region tracking is enabled, see \ref gfxSetDirtyTracking.
+void gfxMarkDirty(u32 x, u32 y, u32 width, u32 height);
+
 /// Use this to get the pixel-offset in the framebuffer. Returned value is in pixels, not bytes.
 /// This implements tegra blocklinear, with hard-coded constants etc.
 /// Do not use this when \ref GfxMode is GfxMode_LinearDouble.
@@ -0,0 +1,39 @@
+/**
+ * @file gfx2d.h
+ * @brief Software 2D drawing into the framebuffer.
+ * These operate on the framebuffer returned by \ref gfxGetFramebuffer, directly in the tiled (block-linear) layout with GfxMode_TiledSingle/GfxMode_TiledDouble, or in the linear-framebuffer with GfxMode_LinearDouble.
+ * Coordinates are the same as the ones used with \ref gfxGetFramebufferDisplayOffset. Drawing is clipped to the display width/height, and the drawn region is marked with \ref gfxMarkDirty.
+ * @copyright libnx Authors
+ */
+#pragma once
+#include "../types.h"
+
+/// Fills a rectangle with a RGBA8 color.
+void gfxFillRect(s32 x, s32 y, u32 width, u32 height, u32 color);
+
+/**
+ * @brief Copies a linear RGBA8 image into the framebuffer.
+ * @param[in] x Horizontal position of the image in the framebuffer.
+ * @param[in] y Vertical position of the image in the framebuffer.
+ * @param[in] image Image pixels.
+ * @param[in] width Image width, in pixels.
+ * @param[in] height Image height, in pixels.
+ * @param[in] stride Distance between image rows, in pixels.
+ */
+void gfxBlit(s32 x, s32 y, const u32 *image, u32 width, u32 height, u32 stride);
+
+/// Same as \ref gfxBlit, except that the image is alpha-blended over the framebuffer using the alpha of each image pixel (non-premultiplied).
+void gfxBlitAlpha(s32 x, s32 y, const u32 *image, u32 width, u32 height, u32 stride);
+
+/**
+ * @brief Copies a linear RGBA8 image into a rectangle of the framebuffer, scaling it with nearest-neighbor sampling.
+ * @param[in] x Horizontal position of the rectangle in the framebuffer.
+ * @param[in] y Vertical position of the rectangle in the framebuffer.
+ * @param[in] dst_width Rectangle width, in pixels.
+ * @param[in] dst_height Rectangle height, in pixels.
+ * @param[in] image Image pixels.
+ * @param[in] width Image width, in pixels.
+ * @param[in] height Image height, in pixels.
+ * @param[in] stride Distance between image rows, in pixels.
+ */
+void gfxBlitScaled(s32 x, s32 y, u32 dst_width, u32 dst_height, const u32 *image, u32 width, u32 height, u32 stride);
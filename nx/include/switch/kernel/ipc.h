@@ -17,6 +17,55 @@
 /// IPC invalid object ID
 #define IPC_INVALID_OBJECT_ID UINT32_MAX
 
+///@name IPC tracing
+///@{
+
+/// Number of buckets in the \ref IpcTraceStats latency histogram.
+#define IPC_TRACE_HISTOGRAM_BUCKETS 16
+/// Maximum number of per-thread trace ring buffers.
+#define IPC_TRACE_MAX_RINGS 32
+
+/// Aggregated trace statistics for one command of one session.
+typedef struct {
+    char   service[9];                        ///< Name of the service the session was obtained from with \ref smGetService, empty when unknown.
+    Handle session;                           ///< IPC session handle.
+    u32    cmd_id;                            ///< Command ID, UINT32_MAX for messages without one (such as session close).
+    u64    count;                             ///< Number of recorded calls.
+    u64    total_ticks;                       ///< Total duration of the calls, in system ticks.
+    u64    max_ticks;                         ///< Longest call, in system ticks.
+    u64    in_bytes;                          ///< Total raw data size of the requests.
+    u64    out_bytes;                         ///< Total raw data size of the responses.
+    u32    histogram[IPC_TRACE_HISTOGRAM_BUCKETS]; ///< Number of calls per duration: bucket 0 is below 1us, bucket i is [2^(i-1), 2^i) us, and the last bucket also holds all longer calls.
+} IpcTraceStats;
+
+extern bool g_ipcTraceEnabled;
+
+/**
+ * @brief Enables or disables IPC tracing (disabled by default).
+ * When enabled, every \ref ipcDispatch is timed and recorded into a lock-free ring buffer owned by the calling thread, which keeps the most recent calls.
+ * The ring buffer of a thread is acquired on its first traced call. At most \ref IPC_TRACE_MAX_RINGS ring buffers are allocated, and they are never freed: once a thread created with \ref threadCreate exits, its ring buffer (with the calls recorded so far) is reused by the next thread that needs one. Calls of threads beyond this cap are not recorded.
+ */
+void ipcTraceSetEnabled(bool enabled);
+
+/// Discards all the calls recorded so far.
+void ipcTraceReset(void);
+
+/**
+ * @brief Aggregates the recorded calls of all threads per session and command ID.
+ * @param[out] out Output stats array.
+ * @param[in] max Maximum number of entries to write.
+ * @return Number of entries written.
+ */
+size_t ipcTraceGetStats(IpcTraceStats* out, size_t max);
+
+/// Associates a service name (as encoded by \ref smEncodeName) to a session, for \ref IpcTraceStats. This is done by \ref smGetService.
+void ipcTraceSetSessionName(Handle session, u64 name);
+
+/// Same as \ref ipcDispatch, but always records the call. Used by \ref ipcDispatch when tracing is enabled.
+Result ipcDispatchTraced(Handle session);
+
+///@}
+
 ///@name IPC request building
 ///@{
 
@@ -344,6 +393,9 @@ static inline void* ipcPrepareHeader(IpcCommand* cmd, size_t sizeof_raw) {
  * @return Result code.
  */
 static inline Result ipcDispatch(Handle session) {
+    if (__builtin_expect(g_ipcTraceEnabled, 0))
+        return ipcDispatchTraced(session);
+
     return svcSendSyncRequest(session);
 }
 
@@ -31,9 +31,20 @@
 #define CONSOLE_CYAN    CONSOLE_ESC(36;1m)
 #define CONSOLE_WHITE   CONSOLE_ESC(37;1m)
 
+/// Maximum number of parameters of an escape sequence, further ones cause the sequence to be ignored.
+#define CONSOLE_ESC_MAX_PARAMS 16
+
 /// A callback for printing a character.
 typedef bool(*ConsolePrint)(void* con, int c);
 
+/// Controls when the console output is presented to the screen.
+typedef enum
+{
+	ConsolePresent_Auto,      ///< Present pending output at the end of a write if at least a frame has passed since the previous presentation, otherwise it stays pending until a later write or \ref consoleUpdate (default). Writes never block. Call \ref consoleUpdate before blocking to make sure everything printed is shown.
+	ConsolePresent_Immediate, ///< Present and wait for vsync after every line, slow.
+	ConsolePresent_Manual,    ///< Only present from \ref consoleUpdate.
+} ConsolePresentMode;
+
 /// A font struct for the console.
 typedef struct ConsoleFont
 {
@@ -99,6 +110,22 @@ typedef struct PrintConsole
 	ConsolePrint PrintChar;  ///< Callback for printing a character. Should return true if it has handled rendering the graphics (else the print engine will attempt to render via tiles).
 
 	bool consoleInitialised; ///< True if the console is initialized
+
+	ConsolePresentMode presentMode; ///< When output is presented, see \ref ConsolePresentMode
+	bool dirty;              ///< Internal state: output is pending presentation
+	u64 lastPresentTick;     ///< Internal state: system tick of the last presentation
+
+	struct ConsoleCell* cells;         ///< Internal state: window contents, a ring of rows starting at cellHead
+	struct ConsoleCell* drawnCells[2]; ///< Internal state: window contents as drawn in frameBuffer and frameBuffer2
+	int cellWidth;                     ///< Internal state: width of the cell buffers
+	int cellHeight;                    ///< Internal state: height of the cell buffers
+	int cellHead;                      ///< Internal state: ring index of the top row of the window
+	u8 renderPending;                  ///< Internal state: bit N is set when drawnCells[N] is out of date
+
+	u8 escState;                               ///< Internal state: escape sequence parser state
+	bool escIgnore;                            ///< Internal state: the current escape sequence is unsupported
+	int escParamCount;                         ///< Internal state: number of escape sequence parameters
+	int escParams[CONSOLE_ESC_MAX_PARAMS];     ///< Internal state: escape sequence parameters, -1 when omitted
 }PrintConsole;
 
 #define CONSOLE_COLOR_BOLD	(1<<0) ///< Bold text
@@ -154,6 +181,7 @@ PrintConsole *consoleSelect(PrintConsole* console);
  * @brief Initialise the console.
  * @param console A pointer to the console data to initialize (if it's NULL, the default console will be used).
  * @return A pointer to the current console.
+ * @note Only 2 framebuffers are supported, this uses \ref fatalSimple when \ref gfxConfigureFramebufferCount was used with a higher count.
  */
 PrintConsole* consoleInit(PrintConsole* console);
 
@@ -163,5 +191,19 @@ PrintConsole* consoleInit(PrintConsole* console);
  */
 void consoleDebugInit(debugDevice device);
 
+/**
+ * @brief Sets when the output of a console is presented to the screen.
+ * @param console Console to set, if NULL it will set the current console.
+ * @param mode Presentation mode.
+ */
+void consoleSetPresentMode(PrintConsole* console, ConsolePresentMode mode);
+
+/**
+ * @brief Presents pending console output and waits for vsync.
+ * This replaces the gfxFlushBuffers/gfxSwapBuffers/gfxWaitForVsync sequence in the main loop of console applications.
+ * @param console Console to present, if NULL it will present the current console.
+ */
+void consoleUpdate(PrintConsole* console);
+
 /// Clears the screan by using iprintf("\x1b[2J");
 void consoleClear(void);
@@ -8,6 +8,8 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include "../../services/fs.h"
 
 #define FSDEV_DIRITER_MAGIC 0x66736476 ///< "fsdv"
@@ -19,9 +21,60 @@ typedef struct
   FsDir             fd;            ///< File descriptor
   ssize_t           index;         ///< Current entry index
   size_t            size;          ///< Current batch size
-  FsDirectoryEntry entry_data[32]; ///< Temporary storage for reading entries
+  size_t            max_entries;   ///< Capacity of entry_data
+  u32               batches;       ///< Number of non-empty batches read since the directory was opened
+  bool              eof;           ///< Whether FS reported the end of the directory
+  FsFileSystem      *fs;           ///< Filesystem the directory belongs to, used by rewinddir
+  char              path[FS_MAX_PATH]; ///< FS path of the directory, used by rewinddir
+  FsDirectoryEntry  *entry_data;   ///< Temporary storage for reading entries
 } fsdev_dir_t;
 
+/// Directory entry returned by \ref fsdevReadDirBatch.
+typedef struct
+{
+  char        name[FS_MAX_PATH]; ///< Entry name, in UTF-8.
+  struct stat st;                ///< Entry attributes, only st_mode and st_size are filled in.
+} FsdevDirEntry;
+
+/// Entry passed to the \ref fsdevWalk callback.
+typedef struct
+{
+  const char *path;   ///< Full path of the entry, including the device name (e.g. "sdmc:/switch/foo.nro").
+  const char *name;   ///< Name of the entry, pointing into path.
+  u32         depth;  ///< Depth of the entry, 0 for entries of the starting directory.
+  bool        is_dir; ///< Whether the entry is a directory.
+  u64         size;   ///< File size, 0 for directories.
+} FsdevWalkEntry;
+
+/// Values returned by the \ref fsdevWalk callback.
+typedef enum
+{
+  FsdevWalkAction_Continue = 0, ///< Keep walking, descending into the entry if it is a directory.
+  FsdevWalkAction_SkipDir  = 1, ///< Keep walking, but don't descend into the entry.
+  FsdevWalkAction_Stop     = 2, ///< Stop the walk.
+} FsdevWalkAction;
+
+/// Callback invoked by \ref fsdevWalk for every entry, returning a \ref FsdevWalkAction.
+typedef FsdevWalkAction (*FsdevWalkCallback)(const FsdevWalkEntry *entry, void *userdata);
+
+/// Write-back buffering statistics, accumulated over all files.
+typedef struct
+{
+  u64 buffered_writes;      ///< Number of writes stored in a write-back buffer instead of being sent to FS.
+  u64 flushes;              ///< Number of FS writes issued to flush write-back buffers.
+  u64 size_queries_skipped; ///< Number of file size queries avoided for O_APPEND writes.
+  u64 ipcs_saved;           ///< Net number of FS IPCs avoided by write-back buffering.
+} FsdevWriteBufferStats;
+
+/// Statistics about transfers that went through a bounce buffer because FS rejected the caller's buffer (0xD401, memory that can't be mapped for IPC).
+typedef struct
+{
+  u64 read_fallbacks;      ///< Number of reads that needed a bounce buffer.
+  u64 write_fallbacks;     ///< Number of writes that needed a bounce buffer.
+  u64 bytes;               ///< Total number of bytes transferred through bounce buffers.
+  const void *last_buffer; ///< Most recent caller buffer that was rejected, to help locating the caller.
+} FsdevBounceStats;
+
 /// Initializes and mounts the sdmc device if accessible. Also initializes current working directory to point to the folder containing the path to the executable (argv[0]), if it is provided by the environment.
 Result fsdevMountSdmc(void);
 
@@ -39,5 +92,57 @@ Result fsdevCommitDevice(const char *name);
 /// Returns the FsFileSystem for the default device (SD card), if mounted. Used internally by romfs_dev.
 FsFileSystem* fsdevGetDefaultFileSystem(void);
 
+/// Sets the write-back buffer size used by files subsequently opened for writing on the specified device. 0 (the default) disables write-back buffering.
+/// Buffered data is written out on fsync/close/seek/read/ftruncate/fstat, when the buffer is full and when a write isn't contiguous with the pending data.
+/// With buffering enabled, the end of O_APPEND files is only queried once, so the file must not be extended through other handles meanwhile.
+Result fsdevSetDeviceWriteBufferSize(const char *name, size_t size);
+
+/// Sets the write-back buffer size of an open file descriptor, flushing any pending data. 0 disables write-back buffering.
+/// Returns -1 and sets errno on failure.
+int fsdevSetFileWriteBufferSize(int fd, size_t size);
+
+/// Sets the maximum read-ahead size used by files subsequently opened for reading on the specified device. 0 (the default) disables read-ahead.
+/// The read-ahead window starts small and doubles while a file is read sequentially. It is discarded on write, seek and ftruncate.
+Result fsdevSetDeviceReadAheadSize(const char *name, size_t size);
+
+/// Sets the maximum read-ahead size of an open file descriptor. 0 disables read-ahead.
+/// Returns -1 and sets errno on failure.
+int fsdevSetFileReadAheadSize(int fd, size_t size);
+
+/// Reads from an open file at the specified offset, without using or updating the current file offset.
+/// Returns the number of bytes read, or -1 and sets errno on failure.
+ssize_t fsdevPread(int fd, void *buf, size_t len, off_t offset);
+
+/// Writes to an open file at the specified offset, without using or updating the current file offset (even for O_APPEND files).
+/// Returns the number of bytes written, or -1 and sets errno on failure.
+ssize_t fsdevPwrite(int fd, const void *buf, size_t len, off_t offset);
+
+/// Sets how many entries are fetched from FS per directory read for directories opened on the specified device afterwards (default 32). Each entry takes 0x310 bytes.
+Result fsdevSetDeviceDirBatchSize(const char *name, size_t entries);
+
+/// Reads up to max_entries entries from a directory opened with opendir() on a fsdev device, returning the number of entries read, 0 at the end of the directory or -1 on error (with errno set).
+/// This bypasses the per-entry readdir() path, so it shouldn't be mixed with telldir()/seekdir() on the same directory.
+int fsdevReadDirBatch(DIR *dirp, FsdevDirEntry *entries, size_t max_entries);
+
+/**
+ * @brief Walks a directory tree breadth-first, reading entries straight from FS so no stat() is needed per entry.
+ * @param path Directory to walk.
+ * @param num_workers Number of directories read concurrently (0 or 1 reads them all from the calling thread).
+ * @param callback Invoked for every entry. Calls are serialized, but may come from worker threads.
+ * @param userdata Passed to the callback.
+ * @return The first error encountered opening or reading a directory, 0 otherwise. Unreadable subdirectories don't stop the walk.
+ */
+Result fsdevWalk(const char *path, u32 num_workers, FsdevWalkCallback callback, void *userdata);
+
+/// Sets the size of the bounce buffers used when FS rejects the caller's buffer. Must be a multiple of 0x1000, the default is 256 KiB.
+/// A small pool of such buffers is shared by all threads, each being allocated on first use.
+Result fsdevSetBounceBufferSize(size_t size);
+
+/// Retrieves bounce buffer statistics.
+void fsdevGetBounceStats(FsdevBounceStats *out);
+
+/// Retrieves write-back buffering statistics.
+void fsdevGetWriteBufferStats(FsdevWriteBufferStats *out);
+
 /// Unmounts all devices and cleans up any resources used by the FS driver.
 Result fsdevUnmountAll(void);
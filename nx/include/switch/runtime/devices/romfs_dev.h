@@ -10,6 +10,7 @@
 
 #include "../../types.h"
 #include "../../services/fs.h"
+#include "../../kernel/semaphore.h"
 
 /// RomFS header.
 typedef struct
@@ -52,6 +53,41 @@ typedef struct
 
 struct romfs_mount;
 
+/// RomFS block cache statistics.
+typedef struct
+{
+    u64 hits;            ///< Number of block lookups served from the cache.
+    u64 misses;          ///< Number of block lookups that required a read from the backing file/storage.
+    u64 readahead_blocks;///< Number of additional blocks fetched speculatively by sequential read-ahead.
+    u64 bypasses;        ///< Number of reads large enough to skip the cache entirely.
+} RomfsCacheStats;
+
+/// RomFS batched read request.
+typedef struct
+{
+    const char *path; ///< Path of the file within the RomFS.
+    u64 offset;       ///< Offset within the file.
+    u64 size;         ///< Number of bytes to read.
+    void *buffer;     ///< Destination buffer.
+    s64 result;       ///< Output: number of bytes read (less than size when reaching the end of the file), or -1 on error.
+} RomfsReadRequest;
+
+/// Completion callback of an asynchronous RomFS read batch, invoked from the I/O thread.
+typedef void (*RomfsReadBatchCallback)(RomfsReadRequest *requests, size_t count, void *userdata);
+
+/// Asynchronous RomFS read batch. The contents are internal and must not be modified while the batch is pending.
+typedef struct RomfsReadBatch
+{
+    struct romfs_mount *mount;       ///< Mount the batch reads from.
+    RomfsReadRequest *requests;      ///< Requests of the batch.
+    size_t count;                    ///< Number of requests.
+    RomfsReadBatchCallback callback; ///< Completion callback, or NULL.
+    void *userdata;                  ///< User data passed to the callback.
+    Result rc;                       ///< Result of the batch.
+    Semaphore done;                  ///< Signalled once the batch has completed.
+    struct RomfsReadBatch *next;     ///< Next batch in the I/O thread queue.
+} RomfsReadBatch;
+
 /**
  * @brief Mounts the Application's RomFS.
  * @param mount Output mount handle
@@ -86,13 +122,98 @@ static inline Result romfsInitFromStorage(FsStorage storage, u64 offset)
     return romfsMountFromStorage(storage, offset, NULL);
 }
 
+/**
+ * @brief Mounts RomFS from a RomFS image in memory.
+ * @param image Pointer to the RomFS image, which must remain valid until the mount is unmounted.
+ * @param size Size of the RomFS image.
+ * @param mount Output mount handle
+ * @note File reads are served directly from the image, without any IPC.
+ */
+Result romfsMountFromMemory(const void *image, size_t size, struct romfs_mount **mount);
+static inline Result romfsInitFromMemory(const void *image, size_t size)
+{
+    return romfsMountFromMemory(image, size, NULL);
+}
+
+/**
+ * @brief Loads the whole file data region of a RomFS mount into memory, so that further reads are served without IPC.
+ * @param mount RomFS mount handle, or NULL for the currently bound mount.
+ * @note This allocates a heap buffer as large as the file data of the RomFS, and is therefore intended for small asset packs. Memory mounts are already resident.
+ * @warning Must not be called while files of this mount are being read from other threads.
+ */
+Result romfsSetResident(struct romfs_mount *mount);
+
+/**
+ * @brief Retrieves a pointer to the contents of a file, without copying.
+ * @param mount RomFS mount handle, or NULL for the currently bound mount.
+ * @param path Path of the file within the RomFS.
+ * @param data Output pointer to the file contents, valid until the mount is unmounted.
+ * @param size Output file size.
+ * @note Only available for mounts created with \ref romfsMountFromMemory or made resident with \ref romfsSetResident.
+ */
+Result romfsGetFileData(struct romfs_mount *mount, const char *path, const void **data, u64 *size);
+
+/**
+ * @brief Builds a full-path index for a RomFS mount, which open and stat consult before walking the path component by component.
+ * @param mount RomFS mount handle, or NULL for the currently bound mount.
+ * @note The index uses 32 to 64 bytes per file and directory (a power-of-two table of 16-byte slots, kept at most half full). Only absolute paths (or paths relative to the root directory) without "." or ".." components take the fast path.
+ * @warning Must not be called while other threads are opening files of this mount.
+ */
+Result romfsCreatePathIndex(struct romfs_mount *mount);
+
+/**
+ * @brief Performs a batch of reads, coalescing requests that are adjacent in the RomFS image into single reads.
+ * @param mount RomFS mount handle, or NULL for the currently bound mount.
+ * @param requests Array of read requests. The result field of each request is filled in.
+ * @param count Number of requests.
+ * @return 0 if every request succeeded, otherwise the error of the first failing request.
+ */
+Result romfsReadBatch(struct romfs_mount *mount, RomfsReadRequest *requests, size_t count);
+
+/**
+ * @brief Queues a batch of reads to be performed by the RomFS I/O thread (see \ref romfsReadBatch).
+ * @param mount RomFS mount handle, or NULL for the currently bound mount.
+ * @param requests Array of read requests, which must remain valid until the batch has completed.
+ * @param count Number of requests.
+ * @param callback Optional callback invoked from the I/O thread once the batch has completed.
+ * @param userdata User data passed to the callback.
+ * @param batch Batch object, which must remain valid until \ref romfsReadBatchWait has returned.
+ * @note The I/O thread is started on first use and stopped once all RomFS mounts are unmounted. Unmounting waits for the batch of the mount being executed, if any, and fails the queued ones with LibnxError_NotInitialized (their callback is then invoked from the unmounting thread). Unmounting from a batch callback fails with LibnxError_BadInput.
+ */
+Result romfsReadBatchAsync(struct romfs_mount *mount, RomfsReadRequest *requests, size_t count, RomfsReadBatchCallback callback, void *userdata, RomfsReadBatch *batch);
+
+/**
+ * @brief Waits for an asynchronous read batch to complete.
+ * @param batch Batch object passed to \ref romfsReadBatchAsync.
+ * @return Result of the batch, as returned by \ref romfsReadBatch.
+ */
+Result romfsReadBatchWait(RomfsReadBatch *batch);
+
 /// Bind the RomFS mount
 Result romfsBind(struct romfs_mount *mount);
 
-/// Unmounts the RomFS device.
+/// Unmounts the RomFS device. Fails with LibnxError_BadInput when called from a \ref romfsReadBatchAsync callback, which runs on the I/O thread that unmounting waits for.
 Result romfsUnmount(struct romfs_mount *mount);
 static inline Result romfsExit(void)
 {
     return romfsUnmount(NULL);
 }
 
+/**
+ * @brief Configures the block cache of a RomFS mount.
+ * @param mount RomFS mount handle, or NULL for the currently bound mount.
+ * @param block_size Size of each cache block in bytes, must be a power of two. 0 disables the cache.
+ * @param num_blocks Number of blocks held by the cache (LRU replacement).
+ * @param max_readahead Maximum number of blocks fetched by a single read once sequential access is detected. 1 disables read-ahead.
+ * @note The cache is disabled by default. Reads smaller than block_size are served from the cache, larger reads go straight to the backing file/storage.
+ * @warning Must not be called while files of this mount are being read from other threads.
+ */
+Result romfsSetCacheConfig(struct romfs_mount *mount, u32 block_size, u32 num_blocks, u32 max_readahead);
+
+/**
+ * @brief Retrieves the block cache statistics of a RomFS mount.
+ * @param mount RomFS mount handle, or NULL for the currently bound mount.
+ * @param out Output statistics.
+ */
+Result romfsGetCacheStats(struct romfs_mount *mount, RomfsCacheStats *out);
+
@@ -1,5 +1,6 @@
 #pragma once
 #include "../../types.h"
+#include "../../services/fs.h"
 
 /// Configuration structure for socketInitalize
 typedef struct  {
@@ -32,6 +33,85 @@ Result socketGetLastSfdnsresResult(void);
 /// Deinitialize the socket driver.
 void socketExit(void);
 
+struct pollfd;
+
+/// Persistent set of sockets polled by \ref socketPollSetWait, with the fds already translated for bsd:u/s. This isn't thread-safe.
+typedef struct {
+    struct pollfd *fds;     ///< Translated fds and requested events, passed as-is to bsdPoll.
+    int *user_fds;          ///< Corresponding application fds.
+    u32 count;              ///< Number of sockets in the set.
+    u32 capacity;           ///< Number of allocated entries.
+} SocketPollSet;
+
+/// Initializes an empty \ref SocketPollSet.
+void socketPollSetInit(SocketPollSet *set);
+/// Frees the memory used by a \ref SocketPollSet.
+void socketPollSetClose(SocketPollSet *set);
+/// Adds a socket to the set, with the poll events to wait for. Sockets must be removed from the set before they are closed. Returns -1 and sets errno on failure.
+int socketPollSetAdd(SocketPollSet *set, int fd, short events);
+/// Changes the poll events to wait for of a socket in the set. Returns -1 and sets errno on failure.
+int socketPollSetModify(SocketPollSet *set, int fd, short events);
+/// Removes a socket from the set. Returns -1 and sets errno on failure.
+int socketPollSetRemove(SocketPollSet *set, int fd);
+/**
+ * @brief Waits for events on the sockets in the set, like poll but without translating the fds on each call.
+ * @param set Socket set.
+ * @param events Output array, receives the application fd, requested events and returned events of each ready socket.
+ * @param maxevents Size of the output array.
+ * @param timeout Timeout in milliseconds, -1 to wait indefinitely.
+ * @return Number of ready sockets written to the output array, 0 on timeout, or -1 with errno set on failure.
+ */
+int socketPollSetWait(SocketPollSet *set, struct pollfd *events, int maxevents, int timeout);
+
+/// Page-aligned buffer for large transfers with \ref socketSendBuffer and \ref socketRecvBuffer.
+typedef struct {
+    void *data;     ///< Buffer address, page-aligned.
+    size_t size;    ///< Buffer size, a multiple of the page size.
+} SocketBuffer;
+
+/// Allocates a \ref SocketBuffer, meant to be kept for many transfers. The size is aligned to the page size. Returns -1 and sets errno on failure.
+int socketBufferCreate(SocketBuffer *buf, size_t size);
+/// Frees a \ref SocketBuffer.
+void socketBufferClose(SocketBuffer *buf);
+/// Like send, from a range of a \ref SocketBuffer. The buffer is always mapped into bsd:u/s instead of being copied through its pointer buffer.
+ssize_t socketSendBuffer(int sockfd, const SocketBuffer *buf, size_t offset, size_t len, int flags);
+/// Like recv, into a range of a \ref SocketBuffer. The buffer is always mapped into bsd:u/s instead of being copied through its pointer buffer.
+ssize_t socketRecvBuffer(int sockfd, SocketBuffer *buf, size_t offset, size_t len, int flags);
+/**
+ * @brief Sends part of a file over a socket, like sendfile. A worker thread reads the next chunk of the file while the current one is sent.
+ * @param sockfd Socket.
+ * @param file File to send.
+ * @param offset Offset of the data in the file.
+ * @param count Number of bytes to send, fewer are sent if the end of the file is reached.
+ * @param chunk_size Size of each of the two buffers, 0 for the default (128 KiB).
+ * @return Number of bytes sent, or -1 with errno set when nothing could be sent.
+ */
+ssize_t socketSendFile(int sockfd, FsFile *file, u64 offset, size_t count, size_t chunk_size);
+
+struct addrinfo;
+
+/// Callback for \ref socketGetAddrInfoAsync, called from the resolver thread. gaie and res are the same as with getaddrinfo, res must be freed with freeaddrinfo.
+typedef void (*SocketDnsCallback)(int gaie, struct addrinfo *res, void *userdata);
+
+/**
+ * @brief Asynchronous getaddrinfo. The lookup is done by a resolver thread, started on first use and stopped by \ref socketExit.
+ * @note Only the ai_flags, ai_family, ai_socktype and ai_protocol fields of the hints are used.
+ * @note Requests which are still queued when \ref socketExit is used complete with EAI_AGAIN.
+ * @return 0 when the request was queued, otherwise a getaddrinfo error code. The callback is only called when the request was queued.
+ */
+int socketGetAddrInfoAsync(const char *node, const char *service, const struct addrinfo *hints, SocketDnsCallback callback, void *userdata);
+
+/**
+ * @brief Sets for how long getaddrinfo results are cached. Concurrent lookups of the same name are coalesced regardless.
+ * @param positive_ms Time successful results are kept, in milliseconds (60s by default). 0 disables caching them.
+ * @param negative_ms Time EAI_NONAME results are kept, in milliseconds (10s by default). 0 disables caching them.
+ * @note gethostbyname and gethostbyaddr are not cached, they always query the resolver service.
+ */
+void socketSetDnsCacheTtl(u32 positive_ms, u32 negative_ms);
+
+/// Clears the getaddrinfo cache. This is done automatically by \ref socketExit.
+void socketClearDnsCache(void);
+
 /// Initalize the socket driver using the default configuration.
 static inline Result socketInitializeDefault(void) {
     return socketInitialize(socketGetDefaultInitConfig());
@@ -48,6 +48,10 @@ int bsdSysctl(const int *name, unsigned int namelen, void *oldp, size_t *oldlenp
 ssize_t bsdRecv(int sockfd, void *buf, size_t len, int flags);
 ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags);
+/// Like @ref bsdRecv but the buffer is always mapped into the service instead of going through its pointer buffer. Best used with page-aligned buffers.
+ssize_t bsdRecvMapped(int sockfd, void *buf, size_t len, int flags);
+/// Like @ref bsdSend but the buffer is always mapped into the service instead of going through its pointer buffer. Best used with page-aligned buffers.
+ssize_t bsdSendMapped(int sockfd, const void* buf, size_t len, int flags);
 ssize_t bsdSendTo(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
 int bsdAccept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 int bsdBind(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
@@ -1,8 +1,12 @@
 #include <string.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include "types.h"
 #include "result.h"
 #include "arm/cache.h"
+#include "kernel/svc.h"
+#include "kernel/thread.h"
+#include "kernel/semaphore.h"
 #include "services/fatal.h"
 #include "services/vi.h"
 #include "services/applet.h"
@@ -12,6 +16,8 @@
 #include "gfx/nvgfx.h"
 #include "gfx/gfx.h"
 
+#define GFX_MAX_FRAMEBUFS 3
+
 static bool g_gfxInitialized = 0;
 static ViDisplay g_gfxDisplay;
 static Handle g_gfxDisplayVsyncEvent = INVALID_HANDLE;
@@ -23,10 +29,12 @@ static Binder g_gfxBinderSession;
 static s32 g_gfxCurrentBuffer = 0;
 static s32 g_gfxCurrentProducerBuffer = 0;
 static bool g_gfx_ProducerConnected = 0;
-static bool g_gfx_ProducerSlotsRequested[2] = {0, 0};
+static bool g_gfx_ProducerSlotsRequested[GFX_MAX_FRAMEBUFS] = {0};
 static u8 *g_gfxFramebuf;
 static size_t g_gfxFramebufSize;
 static bufferProducerFence g_gfx_DequeueBuffer_fence;
+static bufferProducerFence g_gfx_pending_fence;
+static bool g_gfx_fence_pending;
 static bufferProducerQueueBufferOutput g_gfx_Connect_QueueBufferOutput;
 static bufferProducerQueueBufferOutput g_gfx_QueueBuffer_QueueBufferOutput;
 
@@ -34,11 +42,31 @@ static GfxMode g_gfxMode = GfxMode_LinearDouble;
 
 static u8 *g_gfxFramebufLinear;
 
+static bool g_gfx_dirtytracking;
+static u8 *g_gfx_dirtymap; //One byte per 16x16 block of the framebuffer, for each framebuffer.
+static size_t g_gfx_dirtymap_width, g_gfx_dirtymap_height;
+
+#define GFX_MAX_FLUSH_THREADS 3
+
+static Thread g_gfx_flushThreads[GFX_MAX_FLUSH_THREADS];
+static Semaphore g_gfx_flushStart[GFX_MAX_FLUSH_THREADS];
+static Semaphore g_gfx_flushDone;
+static u32 g_gfx_flushNumThreads;
+static bool g_gfx_flushExit;
+static u32 *g_gfx_flushTarget;
+static GfxFlushStats g_gfx_flushStats;
+
+static GfxFrameTiming g_gfx_frameTimings[GFX_FRAME_TIMINGS_MAX];
+static u32 g_gfx_frameTimingsPos, g_gfx_frameTimingsCount;
+static GfxFrameTiming g_gfx_frameCurrent; //Accumulated until the swap which ends the frame.
+static u64 g_gfx_frameLastSwap;
+
 size_t g_gfx_framebuf_width=0, g_gfx_framebuf_aligned_width=0;
 size_t g_gfx_framebuf_height=0, g_gfx_framebuf_aligned_height=0;
 size_t g_gfx_framebuf_display_width=0, g_gfx_framebuf_display_height=0;
 size_t g_gfx_singleframebuf_size=0;
 size_t g_gfx_singleframebuf_linear_size=0;
+u32 g_gfx_framebuf_count=2;
 
 bool g_gfx_drawflip = true;
 
@@ -123,11 +151,28 @@ static Result _gfxGetNativeWindowID(u8 *buf, u64 size, s32 *out_ID) {
     return 0;
 }
 
-static Result _gfxDequeueBuffer(void) {
+//Waits on the fence deferred by gfxSwapBuffersNonBlocking, if any.
+static Result _gfxWaitPendingFence(void) {
+    Result rc=0;
+
+    if (!g_gfx_fence_pending) return 0;
+    g_gfx_fence_pending = 0;
+
+    if (g_gfx_pending_fence.is_valid && g_gfx_pending_fence.nv_fences[0].id!=0xffffffff) {
+        u64 start = svcGetSystemTick();
+        rc = nvgfxEventWait(g_gfx_pending_fence.nv_fences[0].id, g_gfx_pending_fence.nv_fences[0].value, -1);
+        g_gfx_frameCurrent.ticks[GfxFrameTiming_Fence] += svcGetSystemTick() - start;
+    }
+
+    return rc;
+}
+
+static Result _gfxDequeueBuffer(bool wait) {
     Result rc=0;
     bufferProducerFence *fence = &g_gfx_DequeueBuffer_fence;
     bufferProducerFence tmp_fence;
     bool async=0;
+    u64 start, end;
 
     if (g_gfxMode == GfxMode_TiledSingle) {
         g_gfxCurrentProducerBuffer = -1;
@@ -136,12 +181,25 @@ static Result _gfxDequeueBuffer(void) {
 
     memcpy(&tmp_fence, fence, sizeof(bufferProducerFence));//Offical sw waits on the fence from the previous DequeueBuffer call. Using the fence from the current DequeueBuffer call results in nvgfxEventWait() failing.
 
+    start = svcGetSystemTick();
     rc = bufferProducerDequeueBuffer(async, g_gfx_framebuf_width, g_gfx_framebuf_height, 0, 0x300, &g_gfxCurrentProducerBuffer, fence);
+    end = svcGetSystemTick();
+    g_gfx_frameCurrent.ticks[GfxFrameTiming_Dequeue] += end - start;
+
+    //Without wait, the fence is only waited on before the new buffer is used.
+    if (R_SUCCEEDED(rc) && !wait) {
+        memcpy(&g_gfx_pending_fence, &tmp_fence, sizeof(bufferProducerFence));
+        g_gfx_fence_pending = 1;
+    }
 
     //Only run nvgfxEventWait when the fence is valid and the id is not NO_FENCE.
-    if (R_SUCCEEDED(rc) && tmp_fence.is_valid && tmp_fence.nv_fences[0].id!=0xffffffff) rc = nvgfxEventWait(tmp_fence.nv_fences[0].id, tmp_fence.nv_fences[0].value, -1);
+    if (R_SUCCEEDED(rc) && wait && tmp_fence.is_valid && tmp_fence.nv_fences[0].id!=0xffffffff) {
+        rc = nvgfxEventWait(tmp_fence.nv_fences[0].id, tmp_fence.nv_fences[0].value, -1);
+        g_gfx_frameCurrent.ticks[GfxFrameTiming_Fence] += svcGetSystemTick() - end;
+    }
 
-    if (R_SUCCEEDED(rc)) g_gfxCurrentBuffer = (g_gfxCurrentBuffer + 1) & (g_nvgfx_totalframebufs-1);
+    //Slots map 1:1 to the framebuffers, and with 3 of them the queue doesn't necessarily return them in order.
+    if (R_SUCCEEDED(rc)) g_gfxCurrentBuffer = g_gfxCurrentProducerBuffer;
 
     //if (R_SUCCEEDED(rc)) rc = nvgfxSubmitGpfifo();
 
@@ -159,6 +217,7 @@ static Result _gfxQueueBuffer(s32 buf) {
     if (R_FAILED(rc)) return rc;
 
     rc = bufferProducerQueueBuffer(buf, &g_gfxQueueBufferData, &g_gfx_QueueBuffer_QueueBufferOutput);
+    g_gfx_frameCurrent.ticks[GfxFrameTiming_Queue] += svcGetSystemTick() - g_gfxQueueBufferData.timestamp;
     if (R_FAILED(rc)) return rc;
 
     return rc;
@@ -184,6 +243,7 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
 
     memset(g_gfx_ProducerSlotsRequested, 0, sizeof(g_gfx_ProducerSlotsRequested));
     memset(&g_gfx_DequeueBuffer_fence, 0, sizeof(g_gfx_DequeueBuffer_fence));
+    g_gfx_fence_pending = 0;
 
     if (g_gfx_framebuf_width==0 || g_gfx_framebuf_height==0) {
         g_gfx_framebuf_width = 1280;
@@ -221,6 +281,19 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
         return rc;
     }
 
+    g_gfx_dirtymap_width = (g_gfx_framebuf_width+15)/16;
+    g_gfx_dirtymap_height = (g_gfx_framebuf_height+15)/16;
+    g_gfx_dirtymap = malloc(g_gfx_dirtymap_width*g_gfx_dirtymap_height*g_gfx_framebuf_count);
+    if (g_gfx_dirtymap) {
+        memset(g_gfx_dirtymap, 1, g_gfx_dirtymap_width*g_gfx_dirtymap_height*g_gfx_framebuf_count);
+    }
+    else {
+        free(g_gfxFramebufLinear);
+        g_gfxFramebufLinear = NULL;
+        rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        return rc;
+    }
+
     rc = viInitialize(servicetype);
 
     if (R_SUCCEEDED(rc)) rc = viOpenDisplay(DisplayName, &g_gfxDisplay);
@@ -251,8 +324,8 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
     if (R_SUCCEEDED(rc)) rc = nvgfxGetFramebuffer(&g_gfxFramebuf, &g_gfxFramebufSize);
 
     if (R_SUCCEEDED(rc)) { //Official sw would use bufferProducerRequestBuffer() when required during swap-buffers/or similar, but that's not really an option here due to gfxSetDoubleBuffering().
-       for(i=0; i<2; i++) {
-           rc = _gfxDequeueBuffer();
+       for(i=0; i<g_gfx_framebuf_count; i++) {
+           rc = _gfxDequeueBuffer(1);
            if (R_FAILED(rc)) break;
 
            rc = bufferProducerRequestBuffer(g_gfxCurrentProducerBuffer, NULL);
@@ -270,7 +343,7 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
        }
     }
 
-    if (R_SUCCEEDED(rc)) rc = _gfxDequeueBuffer();
+    if (R_SUCCEEDED(rc)) rc = _gfxDequeueBuffer(1);
 
     if (R_SUCCEEDED(rc)) {
         if (__nx_applet_type == AppletType_Application) { //It's unknown whether there's a better way to handle this.
@@ -283,7 +356,7 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
 
     if (R_FAILED(rc)) {
         _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
-        for(i=0; i<2; i++) {
+        for(i=0; i<GFX_MAX_FRAMEBUFS; i++) {
             if (g_gfx_ProducerSlotsRequested[i]) bufferProducerDetachBuffer(i);
         }
         if (g_gfx_ProducerConnected) bufferProducerDisconnect(NATIVE_WINDOW_API_CPU);
@@ -305,6 +378,9 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
         free(g_gfxFramebufLinear);
         g_gfxFramebufLinear = NULL;
 
+        free(g_gfx_dirtymap);
+        g_gfx_dirtymap = NULL;
+
         g_gfxNativeWindow_ID = 0;
         g_gfxCurrentBuffer = 0;
         g_gfxCurrentProducerBuffer = -1;
@@ -318,11 +394,19 @@ static Result _gfxInit(ViServiceType servicetype, const char *DisplayName, u32 L
         memset(g_gfx_ProducerSlotsRequested, 0, sizeof(g_gfx_ProducerSlotsRequested));
     }
 
-    if (R_SUCCEEDED(rc)) g_gfxInitialized = 1;
+    if (R_SUCCEEDED(rc)) {
+        memset(&g_gfx_flushStats, 0, sizeof(g_gfx_flushStats));
+        gfxResetFrameTimings();
+        g_gfxInitialized = 1;
+    }
 
     return rc;
 }
 
+static void _gfxMarkAllDirty(void) {
+    if (g_gfx_dirtymap) memset(g_gfx_dirtymap, 1, g_gfx_dirtymap_width*g_gfx_dirtymap_height*g_gfx_framebuf_count);
+}
+
 void gfxInitDefault(void)
 {
     nvServiceType nv_servicetype;
@@ -351,8 +435,9 @@ void gfxExit(void)
     if (!g_gfxInitialized)
         return;
 
+    _gfxWaitPendingFence();
     _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
-    for (i=0; i<2; i++) {
+    for (i=0; i<GFX_MAX_FRAMEBUFS; i++) {
         if (g_gfx_ProducerSlotsRequested[i]) bufferProducerDetachBuffer(i);
     }
     if (g_gfx_ProducerConnected) bufferProducerDisconnect(2);
@@ -378,6 +463,11 @@ void gfxExit(void)
     free(g_gfxFramebufLinear);
     g_gfxFramebufLinear = NULL;
 
+    free(g_gfx_dirtymap);
+    g_gfx_dirtymap = NULL;
+
+    gfxConfigureFlushThreads(0);
+
     g_gfxInitialized = 0;
     g_gfxNativeWindow_ID = 0;
 
@@ -389,6 +479,7 @@ void gfxExit(void)
 
     g_gfx_framebuf_width = 0;
     g_gfx_framebuf_height = 0;
+    g_gfx_framebuf_count = 2;
 
     gfxConfigureAutoResolution(0, 0, 0, 0, 0);
 
@@ -404,6 +495,14 @@ void gfxInitResolution(u32 width, u32 height) {
     g_gfx_framebuf_height = (height+3) & ~3;
 }
 
+void gfxConfigureFramebufferCount(u32 count) {
+    if (g_gfxInitialized) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_AlreadyInitialized));
+
+    if (count < 2) count = 2;
+    if (count > GFX_MAX_FRAMEBUFS) count = GFX_MAX_FRAMEBUFS;
+    g_gfx_framebuf_count = count;
+}
+
 void gfxInitResolutionDefault(void) {
     gfxInitResolution(1920, 1080);
 }
@@ -432,6 +531,8 @@ void gfxConfigureCrop(s32 left, s32 top, s32 right, s32 bottom) {
         g_gfx_framebuf_display_width = right;
         g_gfx_framebuf_display_height = bottom;
     }
+
+    _gfxMarkAllDirty();
 }
 
 void gfxConfigureResolution(s32 width, s32 height) {
@@ -502,22 +603,98 @@ static void _waitevent(Handle *handle) {
 }
 
 void gfxWaitForVsync(void) {
+    u64 start = svcGetSystemTick();
     _waitevent(&g_gfxDisplayVsyncEvent);
+    g_gfx_frameCurrent.ticks[GfxFrameTiming_Vsync] += svcGetSystemTick() - start;
 }
 
-void gfxSwapBuffers(void) {
+//Moves the timing accumulated for the current frame into the ring buffer, start is the tick at the start of the swap.
+static void _gfxFrameTimingCommit(u64 start) {
+    GfxFrameTiming *frame = &g_gfx_frameCurrent;
+
+    frame->timestamp = start;
+    frame->ticks[GfxFrameTiming_Frame] = g_gfx_frameLastSwap ? start - g_gfx_frameLastSwap : 0;
+    g_gfx_frameLastSwap = start;
+
+    g_gfx_frameTimings[g_gfx_frameTimingsPos] = *frame;
+    g_gfx_frameTimingsPos = (g_gfx_frameTimingsPos + 1) % GFX_FRAME_TIMINGS_MAX;
+    if (g_gfx_frameTimingsCount < GFX_FRAME_TIMINGS_MAX) g_gfx_frameTimingsCount++;
+
+    memset(frame, 0, sizeof(*frame));
+}
+
+u32 gfxGetFrameTimings(GfxFrameTiming *out, u32 max) {
+    u32 i, count = g_gfx_frameTimingsCount < max ? g_gfx_frameTimingsCount : max;
+    u32 pos = (g_gfx_frameTimingsPos + GFX_FRAME_TIMINGS_MAX - count) % GFX_FRAME_TIMINGS_MAX;
+
+    for (i=0; i<count; i++) out[i] = g_gfx_frameTimings[(pos + i) % GFX_FRAME_TIMINGS_MAX];
+
+    return count;
+}
+
+static int _gfxTicksCompare(const void *a, const void *b) {
+    u64 x = *(const u64*)a, y = *(const u64*)b;
+    return x < y ? -1 : x > y;
+}
+
+void gfxGetFrameTimingStats(GfxFrameTimingType type, GfxFrameTimingStats *out) {
+    u64 ticks[GFX_FRAME_TIMINGS_MAX];
+    u64 total = 0;
+    u32 i, count = g_gfx_frameTimingsCount;
+
+    memset(out, 0, sizeof(*out));
+    if (type >= GfxFrameTiming_Count || count == 0) return;
+
+    for (i=0; i<count; i++) {
+        ticks[i] = g_gfx_frameTimings[i].ticks[type];
+        total += ticks[i];
+    }
+
+    qsort(ticks, count, sizeof(u64), _gfxTicksCompare);
+
+    out->min = ticks[0];
+    out->avg = total / count;
+    out->p99 = ticks[(count*99 + 99)/100 - 1]; //Nearest-rank.
+    out->max = ticks[count-1];
+    out->count = count;
+}
+
+void gfxResetFrameTimings(void) {
+    memset(g_gfx_frameTimings, 0, sizeof(g_gfx_frameTimings));
+    memset(&g_gfx_frameCurrent, 0, sizeof(g_gfx_frameCurrent));
+    g_gfx_frameTimingsPos = 0;
+    g_gfx_frameTimingsCount = 0;
+    g_gfx_frameLastSwap = 0;
+}
+
+static void _gfxSwapBuffers(bool wait) {
     Result rc=0;
+    u64 start = svcGetSystemTick();
+
+    rc = _gfxWaitPendingFence();
 
-    rc = _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
+    if (R_SUCCEEDED(rc)) rc = _gfxQueueBuffer(g_gfxCurrentProducerBuffer);
 
     if (R_FAILED(rc)) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGfxQueueBuffer));
 
-    rc = _gfxDequeueBuffer();
+    rc = _gfxDequeueBuffer(wait);
 
     if (R_FAILED(rc)) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGfxDequeueBuffer));
+
+    _gfxFrameTimingCommit(start);
+}
+
+void gfxSwapBuffers(void) {
+    _gfxSwapBuffers(1);
+}
+
+void gfxSwapBuffersNonBlocking(void) {
+    _gfxSwapBuffers(0);
 }
 
 u8* gfxGetFramebuffer(u32* width, u32* height) {
+    if (R_FAILED(_gfxWaitPendingFence())) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGfxDequeueBuffer));
+
     if(width) *width = g_gfx_framebuf_display_width;
     if(height) *height = g_gfx_framebuf_display_height;
 
@@ -541,33 +718,246 @@ size_t gfxGetFramebufferSize(void) {
 
 void gfxSetMode(GfxMode mode) {
     g_gfxMode = mode;
+    _gfxMarkAllDirty();
+}
+
+GfxMode gfxGetMode(void) {
+    return g_gfxMode;
 }
 
 void gfxSetDrawFlip(bool flip) {
     g_gfx_drawflip = flip;
+    _gfxMarkAllDirty();
 }
 
 void gfxConfigureTransform(u32 transform) {
     g_gfxQueueBufferData.transform = transform;
 }
 
-void gfxFlushBuffers(void) {
-    u32 *actual_framebuf = (u32*)&g_gfxFramebuf[g_gfxCurrentBuffer*g_gfx_singleframebuf_size];
+//Copies rows [y0, y1) and columns [x0, x1) of the linear framebuffer into the block-linear one. y0/y1 must be even and x0/x1 multiples of 4.
+//Within a 16x16 block, pixels 0-7 of an even row and the following odd row are interleaved as 4-pixel runs into 64 contiguous bytes, pixels 8-15 follow 256 bytes later. Row pairs are also kept together by the vertical flip, since the height is a multiple of 4.
+static void _gfxSwizzle(u32 *out, const u32 *in, size_t stride, u32 x0, u32 y0, u32 x1, u32 y1) {
+    static const u32 run_offsets[4] = {0, 8, 64, 72};
+    size_t band_size = g_gfx_framebuf_aligned_width/16*8 * 16*16;
+    size_t height = g_gfx_framebuf_display_height;
+    u32 x, y;
+
+    for (y=y0; y<y1; y+=2) {
+        u32 ty = g_gfx_drawflip ? height-2-y : y;
+        const u32 *even = &in[(g_gfx_drawflip ? y+1 : y) * stride];
+        const u32 *odd = &in[(g_gfx_drawflip ? y : y+1) * stride];
+        u32 *row = &out[(ty/128)*band_size + ((ty & 127)/16)*256 + ((ty%16)/8)*128 + ((ty%8)/2)*16];
+
+        for (x=x0; x<x1 && (x & 15); x+=4) {
+            u32 *dst = &row[(x/16)*8*256 + run_offsets[(x%16)/4]];
+            *((u128*)&dst[0]) = *((const u128*)&even[x]);
+            *((u128*)&dst[4]) = *((const u128*)&odd[x]);
+        }
 
-    if (g_gfxMode == GfxMode_LinearDouble) {
-        size_t x, y;
-        size_t width = g_gfx_framebuf_display_width;
-        size_t height = g_gfx_framebuf_display_height;
-        u32 *in_framebuf = (u32*)g_gfxFramebufLinear;
+        for (; x+16<=x1; x+=16) {
+            u32 *dst = &row[(x/16)*8*256];
+            u128 a0 = *((const u128*)&even[x]), a1 = *((const u128*)&even[x+4]), a2 = *((const u128*)&even[x+8]), a3 = *((const u128*)&even[x+12]);
+            u128 b0 = *((const u128*)&odd[x]), b1 = *((const u128*)&odd[x+4]), b2 = *((const u128*)&odd[x+8]), b3 = *((const u128*)&odd[x+12]);
+            *((u128*)&dst[0]) = a0;
+            *((u128*)&dst[4]) = b0;
+            *((u128*)&dst[8]) = a1;
+            *((u128*)&dst[12]) = b1;
+            *((u128*)&dst[64]) = a2;
+            *((u128*)&dst[68]) = b2;
+            *((u128*)&dst[72]) = a3;
+            *((u128*)&dst[76]) = b3;
+        }
+
+        for (; x<x1; x+=4) {
+            u32 *dst = &row[(x/16)*8*256 + run_offsets[(x%16)/4]];
+            *((u128*)&dst[0]) = *((const u128*)&even[x]);
+            *((u128*)&dst[4]) = *((const u128*)&odd[x]);
+        }
+    }
+}
+
+//Flushes the actual framebuffer blocks holding rows [y0, y1) and columns [x0, x1), in drawing coordinates.
+static void _gfxFlushRect(u32 *framebuf, u32 x0, u32 y0, u32 x1, u32 y1) {
+    size_t band_blocks = g_gfx_framebuf_aligned_width/16*8;
+    size_t height = g_gfx_framebuf_display_height;
+    u32 ty0 = g_gfx_drawflip ? height-y1 : y0;
+    u32 ty1 = g_gfx_drawflip ? height-y0 : y1;
+    u32 bx, tb, tb_end;
+
+    //The blocks of a column are contiguous within a 128-row band.
+    for (bx=x0/16; bx<=(x1-1)/16; bx++) {
+        for (tb=ty0/16; tb<=(ty1-1)/16; tb=tb_end) {
+            tb_end = (tb/8+1)*8;
+            if (tb_end > (ty1-1)/16+1) tb_end = (ty1-1)/16+1;
+
+            armDCacheFlush(&framebuf[((tb/8)*band_blocks + bx*8 + tb%8)*256], (tb_end-tb)*256*4);
+        }
+    }
+}
 
-        for (y=0; y<height; y++) {
-            for (x=0; x<width; x+=4) {
-                *((u128*)&actual_framebuf[gfxGetFramebufferDisplayOffset(x, y)]) = *((u128*)&in_framebuf[y * width + x]);
-            }
+//Transfers and flushes the blocks marked dirty for the current framebuffer, in block rows [by0, by1).
+static void _gfxFlushDirty(u32 *framebuf, u32 by0, u32 by1) {
+    u8 *map = &g_gfx_dirtymap[g_gfxCurrentBuffer*g_gfx_dirtymap_width*g_gfx_dirtymap_height];
+    size_t width = g_gfx_framebuf_display_width;
+    size_t height = g_gfx_framebuf_display_height;
+    u32 bx, by, start;
+
+    for (by=by0; by<by1; by++) {
+        u8 *row = &map[by*g_gfx_dirtymap_width];
+        u32 y0 = by*16;
+        u32 y1 = y0+16 < height ? y0+16 : height;
+
+        for (bx=0; bx<(width+15)/16; bx++) {
+            if (!row[bx]) continue;
+
+            //Handle each horizontal run of dirty blocks at once.
+            for (start=bx; bx<(width+15)/16 && row[bx]; bx++) row[bx] = 0;
+
+            u32 x0 = start*16;
+            u32 x1 = bx*16 < width ? bx*16 : width;
+
+            if (g_gfxMode == GfxMode_LinearDouble)
+                _gfxSwizzle(framebuf, (u32*)g_gfxFramebufLinear, width, x0, y0, x1, y1);
+
+            _gfxFlushRect(framebuf, x0, y0, x1, y1);
         }
     }
+}
+
+void gfxSetDirtyTracking(bool enable) {
+    g_gfx_dirtytracking = enable;
+    _gfxMarkAllDirty();
+}
+
+void gfxMarkDirty(u32 x, u32 y, u32 width, u32 height) {
+    size_t x1 = (size_t)x + width;
+    size_t y1 = (size_t)y + height;
+    size_t bx, by, i;
+
+    if (!g_gfx_dirtymap) return;
+
+    if (x1 > g_gfx_framebuf_display_width) x1 = g_gfx_framebuf_display_width;
+    if (y1 > g_gfx_framebuf_display_height) y1 = g_gfx_framebuf_display_height;
+    if (x >= x1 || y >= y1) return;
+
+    //Every framebuffer needs the update, each is brought up to date when it is next flushed.
+    for (i=0; i<g_gfx_framebuf_count; i++) {
+        u8 *map = &g_gfx_dirtymap[i*g_gfx_dirtymap_width*g_gfx_dirtymap_height];
+
+        for (by=y/16; by<=(y1-1)/16; by++) {
+            for (bx=x/16; bx<=(x1-1)/16; bx++) map[by*g_gfx_dirtymap_width + bx] = 1;
+        }
+    }
+}
+
+//Handles part of a gfxFlushBuffers call: a range of block rows with dirty tracking, a range of 128-row bands of the actual framebuffer otherwise.
+static void _gfxFlushPart(u32 *framebuf, u32 part, u32 num_parts) {
+    size_t width = g_gfx_framebuf_display_width;
+    size_t height = g_gfx_framebuf_display_height;
+
+    if (g_gfx_dirtytracking && g_gfx_dirtymap) {
+        u32 rows = (height+15)/16;
+        _gfxFlushDirty(framebuf, rows*part/num_parts, rows*(part+1)/num_parts);
+        return;
+    }
+
+    size_t band_size = g_gfx_framebuf_aligned_width*128;
+    u32 bands = g_gfx_framebuf_aligned_height/128;
+    u32 band0 = bands*part/num_parts;
+    u32 band1 = bands*(part+1)/num_parts;
+    u32 ty0 = band0*128;
+    u32 ty1 = band1*128 < height ? band1*128 : height;
+
+    if (band0 == band1) return;
+
+    if (g_gfxMode == GfxMode_LinearDouble && ty0 < ty1) {
+        if (g_gfx_drawflip)
+            _gfxSwizzle(framebuf, (u32*)g_gfxFramebufLinear, width, 0, height-ty1, width, height-ty0);
+        else
+            _gfxSwizzle(framebuf, (u32*)g_gfxFramebufLinear, width, 0, ty0, width, ty1);
+    }
+
+    armDCacheFlush(&framebuf[band0*band_size], (band1-band0)*band_size*4);
+}
+
+static void _gfxFlushWorker(void *arg) {
+    u32 index = (u32)(uintptr_t)arg;
+
+    for (;;) {
+        semaphoreWait(&g_gfx_flushStart[index]);
+        if (g_gfx_flushExit) break;
+
+        _gfxFlushPart(g_gfx_flushTarget, index+1, g_gfx_flushNumThreads+1);
+        semaphoreSignal(&g_gfx_flushDone);
+    }
+}
+
+Result gfxConfigureFlushThreads(u32 num_threads) {
+    Result rc=0;
+    u32 i;
+
+    if (num_threads > GFX_MAX_FLUSH_THREADS) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (g_gfx_flushNumThreads) {
+        g_gfx_flushExit = true;
+        for (i=0; i<g_gfx_flushNumThreads; i++) semaphoreSignal(&g_gfx_flushStart[i]);
+        for (i=0; i<g_gfx_flushNumThreads; i++) {
+            threadWaitForExit(&g_gfx_flushThreads[i]);
+            threadClose(&g_gfx_flushThreads[i]);
+        }
+        g_gfx_flushNumThreads = 0;
+        g_gfx_flushExit = false;
+    }
+
+    semaphoreInit(&g_gfx_flushDone, 0);
+
+    for (i=0; i<num_threads; i++) {
+        semaphoreInit(&g_gfx_flushStart[i], 0);
+
+        rc = threadCreate(&g_gfx_flushThreads[i], _gfxFlushWorker, (void*)(uintptr_t)i, 0x4000, 0x2C, (i+1)%3);
+        if (R_FAILED(rc)) break;
+
+        rc = threadStart(&g_gfx_flushThreads[i]);
+        if (R_FAILED(rc)) {
+            threadClose(&g_gfx_flushThreads[i]);
+            break;
+        }
+
+        g_gfx_flushNumThreads++;
+    }
+
+    if (R_FAILED(rc)) gfxConfigureFlushThreads(0);
+
+    return rc;
+}
+
+void gfxGetFlushStats(GfxFlushStats *out) {
+    *out = g_gfx_flushStats;
+}
+
+void gfxFlushBuffers(void) {
+    u32 *actual_framebuf = (u32*)&g_gfxFramebuf[g_gfxCurrentBuffer*g_gfx_singleframebuf_size];
+    u64 start;
+    u32 i;
+
+    if (R_FAILED(_gfxWaitPendingFence())) fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadGfxDequeueBuffer));
+
+    start = svcGetSystemTick();
+
+    g_gfx_flushTarget = actual_framebuf;
+    for (i=0; i<g_gfx_flushNumThreads; i++) semaphoreSignal(&g_gfx_flushStart[i]);
+
+    _gfxFlushPart(actual_framebuf, 0, g_gfx_flushNumThreads+1);
+
+    for (i=0; i<g_gfx_flushNumThreads; i++) semaphoreWait(&g_gfx_flushDone);
+
+    u64 ticks = svcGetSystemTick() - start;
+    g_gfx_flushStats.last_ticks = ticks;
+    if (ticks > g_gfx_flushStats.max_ticks) g_gfx_flushStats.max_ticks = ticks;
+    g_gfx_flushStats.total_ticks += ticks;
+    g_gfx_flushStats.count++;
 
-    armDCacheFlush(actual_framebuf, g_gfx_singleframebuf_size);
+    g_gfx_frameCurrent.ticks[GfxFrameTiming_Flush] += ticks;
 }
 
 /*static Result _gfxGetDisplayResolution(u64 *width, u64 *height) {
@@ -0,0 +1,170 @@
+#include <string.h>
+#include "types.h"
+#include "gfx/gfx.h"
+#include "gfx/gfx2d.h"
+
+extern size_t g_gfx_framebuf_aligned_width;
+extern bool g_gfx_drawflip;
+
+typedef struct {
+    u32 *fb;
+    u32 width, height;
+    bool linear;
+} gfx2d_target;
+
+//Gets the current framebuffer and clips the rectangle to it. Returns false when nothing is left to draw.
+static bool _gfx2dSetup(gfx2d_target *t, s32 x, s32 y, u32 width, u32 height, u32 *x0, u32 *y0, u32 *x1, u32 *y1) {
+    s64 ex = (s64)x + width;
+    s64 ey = (s64)y + height;
+
+    t->fb = (u32*)gfxGetFramebuffer(&t->width, &t->height);
+    t->linear = gfxGetMode() == GfxMode_LinearDouble;
+
+    if (ex > t->width) ex = t->width;
+    if (ey > t->height) ey = t->height;
+    *x0 = x < 0 ? 0 : x;
+    *y0 = y < 0 ? 0 : y;
+    if ((s64)*x0 >= ex || (s64)*y0 >= ey) return false;
+
+    *x1 = ex;
+    *y1 = ey;
+    return true;
+}
+
+//Returns the first pixel of a row, all the 4-pixel runs of a row are at fixed offsets from it.
+static inline u32* _gfx2dRow(const gfx2d_target *t, u32 y) {
+    if (t->linear) return &t->fb[y*t->width];
+
+    if (g_gfx_drawflip) y = t->height-1-y;
+    return &t->fb[(y/128)*(g_gfx_framebuf_aligned_width/16*8)*256 + ((y & 127)/16)*256 + ((y%16)/8)*128 + ((y%8)/2)*16 + (y%2)*4];
+}
+
+//Returns the 16-byte aligned run of 4 pixels holding pixel x, see gfxGetFramebufferDisplayOffset.
+static inline u32* _gfx2dRun(const gfx2d_target *t, u32 *row, u32 x) {
+    if (t->linear) return &row[x & ~3];
+
+    return &row[(x/16)*8*256 + ((x%16)/8)*64 + ((x%8)/4)*8];
+}
+
+//Blends src over dst, with two 8-bit channels per 32-bit operation. The alpha channel of the output is src_a + dst_a*(1-src_a).
+static inline u32 _gfx2dBlend(u32 dst, u32 src) {
+    u32 a = src >> 24;
+    u32 ia = 255 - a;
+
+    if (a == 255) return src;
+    if (a == 0) return dst;
+
+    u32 rb = (src & 0x00ff00ff)*a + (dst & 0x00ff00ff)*ia;
+    u32 ga = (((src >> 8) & 0xff) | 0x00ff0000)*a + ((dst >> 8) & 0x00ff00ff)*ia;
+
+    //Division by 255 with rounding, per 16-bit lane.
+    rb += 0x00800080;
+    ga += 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+    ga = ((ga + ((ga >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+
+    return rb | (ga << 8);
+}
+
+void gfxFillRect(s32 x, s32 y, u32 width, u32 height, u32 color) {
+    gfx2d_target t;
+    u32 x0, y0, x1, y1, px, py;
+    u32 pattern[4] __attribute__((aligned(16))) = {color, color, color, color};
+    u128 fill = *((u128*)pattern);
+
+    if (!_gfx2dSetup(&t, x, y, width, height, &x0, &y0, &x1, &y1)) return;
+
+    for (py=y0; py<y1; py++) {
+        u32 *row = _gfx2dRow(&t, py);
+
+        for (px=x0; px<x1; ) {
+            u32 *run = _gfx2dRun(&t, row, px);
+
+            if ((px & 3)==0 && px+4<=x1) {
+                *((u128*)run) = fill;
+                px+=4;
+            }
+            else {
+                run[px & 3] = color;
+                px++;
+            }
+        }
+    }
+
+    gfxMarkDirty(x0, y0, x1-x0, y1-y0);
+}
+
+void gfxBlit(s32 x, s32 y, const u32 *image, u32 width, u32 height, u32 stride) {
+    gfx2d_target t;
+    u32 x0, y0, x1, y1, px, py;
+
+    if (!_gfx2dSetup(&t, x, y, width, height, &x0, &y0, &x1, &y1)) return;
+
+    for (py=y0; py<y1; py++) {
+        u32 *row = _gfx2dRow(&t, py);
+        const u32 *src = &image[(size_t)(py-y)*stride + (x0-x)];
+
+        for (px=x0; px<x1; ) {
+            u32 *run = _gfx2dRun(&t, row, px);
+
+            if ((px & 3)==0 && px+4<=x1) {
+                memcpy(run, &src[px-x0], 16); //The image isn't necessarily 16-byte aligned.
+                px+=4;
+            }
+            else {
+                run[px & 3] = src[px-x0];
+                px++;
+            }
+        }
+    }
+
+    gfxMarkDirty(x0, y0, x1-x0, y1-y0);
+}
+
+void gfxBlitAlpha(s32 x, s32 y, const u32 *image, u32 width, u32 height, u32 stride) {
+    gfx2d_target t;
+    u32 x0, y0, x1, y1, px, py, i;
+
+    if (!_gfx2dSetup(&t, x, y, width, height, &x0, &y0, &x1, &y1)) return;
+
+    for (py=y0; py<y1; py++) {
+        u32 *row = _gfx2dRow(&t, py);
+        const u32 *src = &image[(size_t)(py-y)*stride + (x0-x)];
+
+        for (px=x0; px<x1; ) {
+            u32 *run = _gfx2dRun(&t, row, px);
+            u32 end = (px | 3) + 1 < x1 ? (px | 3) + 1 : x1;
+
+            for (i=px & 3; px<end; i++, px++) run[i] = _gfx2dBlend(run[i], src[px-x0]);
+        }
+    }
+
+    gfxMarkDirty(x0, y0, x1-x0, y1-y0);
+}
+
+void gfxBlitScaled(s32 x, s32 y, u32 dst_width, u32 dst_height, const u32 *image, u32 width, u32 height, u32 stride) {
+    gfx2d_target t;
+    u32 x0, y0, x1, y1, px, py, i;
+
+    if (width==0 || height==0) return;
+    if (!_gfx2dSetup(&t, x, y, dst_width, dst_height, &x0, &y0, &x1, &y1)) return;
+
+    //16.16 fixed-point source steps per destination pixel.
+    u64 step_x = ((u64)width << 16) / dst_width;
+    u64 step_y = ((u64)height << 16) / dst_height;
+
+    for (py=y0; py<y1; py++) {
+        u32 *row = _gfx2dRow(&t, py);
+        const u32 *src = &image[(size_t)(((u64)(py-y)*step_y) >> 16)*stride];
+        u64 fx = (u64)(x0-x)*step_x;
+
+        for (px=x0; px<x1; ) {
+            u32 *run = _gfx2dRun(&t, row, px);
+            u32 end = (px | 3) + 1 < x1 ? (px | 3) + 1 : x1;
+
+            for (i=px & 3; px<end; i++, px++, fx+=step_x) run[i] = src[fx >> 16];
+        }
+    }
+
+    gfxMarkDirty(x0, y0, x1-x0, y1-y0);
+}
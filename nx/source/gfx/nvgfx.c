@@ -54,6 +54,7 @@ static u64 nvmap_obj6_mapbuffer_xdb_offset;
 static u64 g_nvgfx_gpfifo_pos = 0;
 
 extern size_t g_gfx_singleframebuf_size;
+extern u32 g_gfx_framebuf_count;
 
 Result _gfxGraphicBufferInit(s32 buf, u32 nvmap_handle);
 
@@ -120,7 +121,7 @@ Result nvgfxInitialize(void) {
 
     g_nvgfx_nvhostctrl_eventhandle = INVALID_HANDLE;
 
-    g_nvgfx_totalframebufs = 2;
+    g_nvgfx_totalframebufs = g_gfx_framebuf_count;
 
     memset(nvmap_objs, 0, sizeof(nvmap_objs));
 
@@ -272,7 +273,7 @@ Result nvgfxInitialize(void) {
         rc = bufferProducerQuery(NATIVE_WINDOW_FORMAT, &tmp);//TODO: What does official sw use the output from this for?
 
         if (R_SUCCEEDED(rc)) {
-            for(i=0; i<2; i++) {
+            for(i=0; i<g_nvgfx_totalframebufs; i++) {
                 tmpval = 0;
                 rc = nvioctlNvmap_GetId(g_nvgfx_fd_nvmap, nvmap_objs[6].handle, &tmpval);
                 if (R_FAILED(rc)) break;
@@ -23,6 +23,9 @@ typedef struct {
     void* tls_tp; // !! Offset needs to be TLS+0x1F8 for __aarch64_read_tp !!
 } ThreadVars;
 
+// Releases the IPC trace ring buffer of the calling thread, see kernel/ipc.c
+void ipcTraceThreadExit(void);
+
 static inline ThreadVars* getThreadVars(void) {
     return (ThreadVars*)((u8*)armGetTls() + 0x1E0);
 }
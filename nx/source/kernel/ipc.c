@@ -0,0 +1,280 @@
+#include <string.h>
+#include <malloc.h>
+#include "types.h"
+#include "result.h"
+#include "kernel/svc.h"
+#include "kernel/mutex.h"
+#include "kernel/ipc.h"
+#include "../internal.h"
+
+#define IPC_TRACE_RING_SIZE 128
+#define IPC_TRACE_MAX_SESSIONS 64
+
+typedef struct {
+    u64 seq;        //Position of the record in the ring plus one, 0 while it's being written.
+    u64 ticks;
+    Handle session;
+    u32 cmd_id;
+    u32 in_size;
+    u32 out_size;
+} IpcTraceRecord;
+
+//Written only by the owning thread, read by ipcTraceGetStats from any thread.
+//Rings are never freed: the ring of an exited thread is handed to the next thread that needs one, records included.
+typedef struct IpcTraceRing {
+    struct IpcTraceRing* next;
+    bool owned;
+    u64 pos;
+    u64 base;
+    IpcTraceRecord records[IPC_TRACE_RING_SIZE];
+} IpcTraceRing;
+
+bool g_ipcTraceEnabled;
+
+static IpcTraceRing* g_ipcTraceRings;
+static u32 g_ipcTraceRingCount;
+static __thread IpcTraceRing* g_ipcTraceRing;
+
+static Mutex g_ipcTraceSessionMutex;
+static struct {
+    Handle session;
+    u64 name;
+} g_ipcTraceSessions[IPC_TRACE_MAX_SESSIONS];
+static size_t g_ipcTraceSessionNext;
+
+void ipcTraceSetEnabled(bool enabled) {
+    __atomic_store_n(&g_ipcTraceEnabled, enabled, __ATOMIC_RELAXED);
+}
+
+void ipcTraceSetSessionName(Handle session, u64 name) {
+    size_t i;
+
+    mutexLock(&g_ipcTraceSessionMutex);
+
+    for (i=0; i<IPC_TRACE_MAX_SESSIONS; i++) {
+        if (g_ipcTraceSessions[i].session == session || g_ipcTraceSessions[i].name == 0)
+            break;
+    }
+
+    if (i == IPC_TRACE_MAX_SESSIONS) {
+        i = g_ipcTraceSessionNext;
+        g_ipcTraceSessionNext = (g_ipcTraceSessionNext + 1) % IPC_TRACE_MAX_SESSIONS;
+    }
+
+    g_ipcTraceSessions[i].session = session;
+    g_ipcTraceSessions[i].name = name;
+
+    mutexUnlock(&g_ipcTraceSessionMutex);
+}
+
+//Gets the raw data size of the message in the TLS buffer, and the command ID when it's a request.
+static void _ipcTraceParseMessage(u32* buf, u32* cmd_id, u32* raw_size) {
+    u32 type = buf[0] & 0xffff;
+    u32 num_static = (buf[0] >> 16) & 15;
+    u32 num_buffers = ((buf[0] >> 20) & 15) + ((buf[0] >> 24) & 15) + ((buf[0] >> 28) & 15);
+    u32* p = buf + 2;
+
+    *raw_size = (buf[1] & 0x3ff) * 4;
+    *cmd_id = UINT32_MAX;
+
+    if (buf[1] & 0x80000000) {
+        u32 special = *p++;
+
+        if (special & 1)
+            p += 2;
+
+        p += ((special >> 1) & 15) + ((special >> 5) & 15);
+    }
+
+    p += num_static*2 + num_buffers*3;
+
+    if (type != IpcCommandType_Request && type != IpcCommandType_Control &&
+        type != IpcCommandType_RequestWithContext && type != IpcCommandType_ControlWithContext)
+        return;
+
+    u32* raw = (u32*) ((((uintptr_t) p) + 15) & ~15);
+
+    if (raw[0] == SFCI_MAGIC)
+        *cmd_id = raw[2];
+    else if (raw[4] == SFCI_MAGIC) // Domain message, preceded by a DomainMessageHeader.
+        *cmd_id = raw[6];
+}
+
+//Claims the ring of an exited thread, or allocates a new one unless IPC_TRACE_MAX_RINGS are in use.
+static IpcTraceRing* _ipcTraceRingAcquire(void) {
+    IpcTraceRing* ring;
+
+    for (ring = __atomic_load_n(&g_ipcTraceRings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        bool owned = false;
+
+        if (__atomic_compare_exchange_n(&ring->owned, &owned, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            g_ipcTraceRing = ring;
+            return ring;
+        }
+    }
+
+    if (__atomic_fetch_add(&g_ipcTraceRingCount, 1, __ATOMIC_RELAXED) >= IPC_TRACE_MAX_RINGS) {
+        __atomic_fetch_sub(&g_ipcTraceRingCount, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    ring = (IpcTraceRing*) calloc(1, sizeof(IpcTraceRing));
+
+    if (ring == NULL) {
+        __atomic_fetch_sub(&g_ipcTraceRingCount, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    ring->owned = true;
+    ring->next = __atomic_load_n(&g_ipcTraceRings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_ipcTraceRings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    g_ipcTraceRing = ring;
+    return ring;
+}
+
+void ipcTraceThreadExit(void) {
+    IpcTraceRing* ring = g_ipcTraceRing;
+
+    if (ring == NULL)
+        return;
+
+    g_ipcTraceRing = NULL;
+    __atomic_store_n(&ring->owned, false, __ATOMIC_RELEASE);
+}
+
+Result ipcDispatchTraced(Handle session) {
+    u32* buf = (u32*)armGetTls();
+    IpcTraceRing* ring = g_ipcTraceRing;
+    u32 cmd_id, in_size, out_size;
+    u64 start, ticks;
+    Result rc;
+
+    if (ring == NULL)
+        ring = _ipcTraceRingAcquire();
+
+    _ipcTraceParseMessage(buf, &cmd_id, &in_size);
+
+    start = svcGetSystemTick();
+    rc = svcSendSyncRequest(session);
+    ticks = svcGetSystemTick() - start;
+
+    out_size = 0;
+    if (R_SUCCEEDED(rc)) {
+        u32 unused;
+        _ipcTraceParseMessage(buf, &unused, &out_size);
+    }
+
+    if (ring == NULL)
+        return rc;
+
+    u64 pos = ring->pos;
+    IpcTraceRecord* rec = &ring->records[pos % IPC_TRACE_RING_SIZE];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rec->ticks = ticks;
+    rec->session = session;
+    rec->cmd_id = cmd_id;
+    rec->in_size = in_size;
+    rec->out_size = out_size;
+
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->pos, pos + 1, __ATOMIC_RELEASE);
+
+    return rc;
+}
+
+void ipcTraceReset(void) {
+    IpcTraceRing* ring;
+
+    for (ring = __atomic_load_n(&g_ipcTraceRings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+        __atomic_store_n(&ring->base, __atomic_load_n(&ring->pos, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+}
+
+static u32 _ipcTraceHistogramBucket(u64 ticks) {
+    u64 us = ticks * 10 / 192; // System ticks are 19.2MHz.
+    u32 bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+
+    return bucket < IPC_TRACE_HISTOGRAM_BUCKETS ? bucket : IPC_TRACE_HISTOGRAM_BUCKETS-1;
+}
+
+static void _ipcTraceAddRecord(IpcTraceStats* out, size_t max, size_t* count, const IpcTraceRecord* rec) {
+    IpcTraceStats* stats = NULL;
+    size_t i;
+
+    for (i=0; i<*count; i++) {
+        if (out[i].session == rec->session && out[i].cmd_id == rec->cmd_id) {
+            stats = &out[i];
+            break;
+        }
+    }
+
+    if (stats == NULL) {
+        if (*count >= max)
+            return;
+
+        stats = &out[(*count)++];
+        memset(stats, 0, sizeof(IpcTraceStats));
+        stats->session = rec->session;
+        stats->cmd_id = rec->cmd_id;
+    }
+
+    stats->count++;
+    stats->total_ticks += rec->ticks;
+    if (rec->ticks > stats->max_ticks)
+        stats->max_ticks = rec->ticks;
+    stats->in_bytes += rec->in_size;
+    stats->out_bytes += rec->out_size;
+    stats->histogram[_ipcTraceHistogramBucket(rec->ticks)]++;
+}
+
+size_t ipcTraceGetStats(IpcTraceStats* out, size_t max) {
+    IpcTraceRing* ring;
+    size_t count = 0;
+    size_t i, j;
+    u64 pos;
+
+    for (ring = __atomic_load_n(&g_ipcTraceRings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        u64 end = __atomic_load_n(&ring->pos, __ATOMIC_ACQUIRE);
+        u64 begin = __atomic_load_n(&ring->base, __ATOMIC_RELAXED);
+
+        if (end - begin > IPC_TRACE_RING_SIZE)
+            begin = end - IPC_TRACE_RING_SIZE;
+
+        for (pos=begin; pos<end; pos++) {
+            IpcTraceRecord* src = &ring->records[pos % IPC_TRACE_RING_SIZE];
+            IpcTraceRecord rec;
+
+            // Skip records that the owning thread is overwriting meanwhile.
+            rec.seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+            rec.ticks = src->ticks;
+            rec.session = src->session;
+            rec.cmd_id = src->cmd_id;
+            rec.in_size = src->in_size;
+            rec.out_size = src->out_size;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (rec.seq != pos + 1 || __atomic_load_n(&src->seq, __ATOMIC_RELAXED) != pos + 1)
+                continue;
+
+            _ipcTraceAddRecord(out, max, &count, &rec);
+        }
+    }
+
+    mutexLock(&g_ipcTraceSessionMutex);
+
+    for (i=0; i<count; i++) {
+        for (j=0; j<IPC_TRACE_MAX_SESSIONS; j++) {
+            if (g_ipcTraceSessions[j].name != 0 && g_ipcTraceSessions[j].session == out[i].session) {
+                memcpy(out[i].service, &g_ipcTraceSessions[j].name, 8);
+                break;
+            }
+        }
+    }
+
+    mutexUnlock(&g_ipcTraceSessionMutex);
+
+    return count;
+}
@@ -34,6 +34,7 @@ static void _EntryWrap(ThreadEntryArgs* args) {
 
     // Launch thread entrypoint
     args->entry(args->arg);
+    ipcTraceThreadExit();
     svcExitThread();
 }
 
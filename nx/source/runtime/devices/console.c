@@ -1,12 +1,17 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/iosupport.h>
+#include "result.h"
 #include "runtime/devices/console.h"
 #include "kernel/svc.h"
+#include "services/fatal.h"
 #include "gfx/gfx.h"
 
 #include "default_font_bin.h"
 
+extern u32 g_gfx_framebuf_count;
+
 //set up the palette for color printing
 static u32 colorTable[] = {
 	RGBA8_MAXALPHA(  0,  0,  0),	// black
@@ -70,9 +75,215 @@ PrintConsole* currentConsole = &currentCopy;
 
 PrintConsole* consoleGetDefault(void){return &defaultConsole;}
 
+//A character cell of the console window
+typedef struct ConsoleCell
+{
+	u16 chr;  // glyph index in the font, CONSOLE_CELL_UNSET if never written
+	u8  fg;   // colorTable index of the glyph
+	u8  bg;   // colorTable index of the background
+	u16 deco; // CONSOLE_UNDERLINE and CONSOLE_CROSSED_OUT
+} ConsoleCell;
+
+#define CONSOLE_CELL_UNSET 0xffff
+
+//Escape sequence parser states
+enum
+{
+	CONSOLE_ESC_NONE,  // printing characters
+	CONSOLE_ESC_START, // got ESC
+	CONSOLE_ESC_CSI,   // inside ESC [
+};
+
 void consolePrintChar(int c);
 void consoleDrawChar(int c);
 
+//---------------------------------------------------------------------------------
+static inline ConsoleCell* consoleCellAt(PrintConsole* console, int x, int y) {
+//---------------------------------------------------------------------------------
+	return &console->cells[((console->cellHead + y) % console->cellHeight) * console->cellWidth + x];
+}
+
+//---------------------------------------------------------------------------------
+static inline bool consoleCellEqual(const ConsoleCell* a, const ConsoleCell* b) {
+//---------------------------------------------------------------------------------
+	return a->chr == b->chr && a->fg == b->fg && a->bg == b->bg && a->deco == b->deco;
+}
+
+//---------------------------------------------------------------------------------
+static void consoleInvalidate(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	int i;
+
+	for (i=0; i<console->cellWidth * console->cellHeight; i++) {
+		console->drawnCells[0][i].chr = CONSOLE_CELL_UNSET;
+		console->drawnCells[1][i].chr = CONSOLE_CELL_UNSET;
+	}
+
+	console->renderPending = 3;
+}
+
+// Consoles holding cell buffers allocated by consoleAllocCells. consoleInit only reuses the buffers of these,
+// any other console passed to it may be uninitialized memory.
+#define CONSOLE_MAX_CELL_OWNERS 8
+static PrintConsole* cellOwners[CONSOLE_MAX_CELL_OWNERS];
+
+//---------------------------------------------------------------------------------
+static bool consoleOwnsCells(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	int i;
+
+	for (i=0; i<CONSOLE_MAX_CELL_OWNERS; i++) {
+		if (cellOwners[i] == console) return true;
+	}
+
+	return false;
+}
+
+//---------------------------------------------------------------------------------
+static void consoleAllocCells(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	int count = console->windowWidth * console->windowHeight;
+	int i;
+
+	if (count <= 0) return;
+
+	if (console->cells == NULL || console->cellWidth != console->windowWidth || console->cellHeight != console->windowHeight) {
+		free(console->cells);
+		free(console->drawnCells[0]);
+		free(console->drawnCells[1]);
+
+		console->cells         = (ConsoleCell*)malloc(count * sizeof(ConsoleCell));
+		console->drawnCells[0] = (ConsoleCell*)malloc(count * sizeof(ConsoleCell));
+		console->drawnCells[1] = (ConsoleCell*)malloc(count * sizeof(ConsoleCell));
+
+		if (console->cells == NULL || console->drawnCells[0] == NULL || console->drawnCells[1] == NULL)
+			fatalSimple(MAKERESULT(Module_Libnx, LibnxError_OutOfMemory));
+
+		console->cellWidth  = console->windowWidth;
+		console->cellHeight = console->windowHeight;
+
+		// past the limit, the buffers of the console are dropped when it is initialized again
+		for (i=0; i<CONSOLE_MAX_CELL_OWNERS && !consoleOwnsCells(console); i++) {
+			if (cellOwners[i] == NULL) cellOwners[i] = console;
+		}
+	}
+
+	// cells that were never written leave the framebuffer alone
+	for (i=0; i<count; i++)
+		console->cells[i] = (ConsoleCell){ CONSOLE_CELL_UNSET, 0, 0, 0 };
+
+	console->cellHead = 0;
+	consoleInvalidate(console);
+}
+
+//---------------------------------------------------------------------------------
+static void consoleRenderCell(PrintConsole* console, u32* frameBuffer, int cellX, int cellY, const ConsoleCell* cell) {
+//---------------------------------------------------------------------------------
+	if (cell->chr >= console->font.numChars) return;
+
+	u16 *fontdata = console->font.gfx + (16 * cell->chr);
+
+	u32 bg = colorTable[cell->bg];
+	u32 fg = colorTable[cell->fg];
+
+	// one pattern of four pixels per font nibble, rebuilt when the colors change
+	static u32 patterns[16][4] __attribute__((aligned(16)));
+	static u32 patternsFg, patternsBg;
+	static bool patternsValid = false;
+
+	if (!patternsValid || patternsFg != fg || patternsBg != bg) {
+		int n, k;
+		for (n=0;n<16;n++) {
+			for (k=0;k<4;k++)
+				patterns[n][k] = (n & (8 >> k)) ? fg : bg;
+		}
+		patternsFg = fg;
+		patternsBg = bg;
+		patternsValid = true;
+	}
+
+	u16 rows[16];
+	memcpy(rows, fontdata, sizeof(rows));
+
+	if (cell->deco & CONSOLE_UNDERLINE)  rows[15] = 0xffff;
+
+	if (cell->deco & CONSOLE_CROSSED_OUT) rows[7] = 0xffff;
+
+	// a glyph row is 16 pixels of a 16x16 block, stored as four runs of four contiguous pixels
+	static const u32 runOffsets[4] = { 0, 8, 64, 72 };
+
+	int i, j;
+
+	int x = (cellX + console->windowX) * 16;
+	int y = (cellY + console->windowY) * 16;
+
+	for (j=0;j<16;j++) {
+		u32 rowOffset = gfxGetFramebufferDisplayOffset(x, y + j);
+		u16 bits = rows[j];
+
+		for (i=0;i<4;i++)
+			*(u128*)&frameBuffer[rowOffset + runOffsets[i]] = *(u128*)patterns[(bits >> (12 - 4*i)) & 0xf];
+	}
+}
+
+//---------------------------------------------------------------------------------
+static void consoleRender(PrintConsole* console, int buffer) {
+//---------------------------------------------------------------------------------
+	if (console->cells == NULL || !(console->renderPending & BIT(buffer))) return;
+
+	u32* frameBuffer = buffer ? console->frameBuffer2 : console->frameBuffer;
+	ConsoleCell blank = { ' ' - console->font.asciiOffset, 0, 0, 0 };
+	int x, y;
+
+	// only cells that differ from what this framebuffer shows are drawn
+	for (y=0; y<console->cellHeight; y++) {
+		ConsoleCell* row = consoleCellAt(console, 0, y);
+		ConsoleCell* drawnRow = &console->drawnCells[buffer][y * console->cellWidth];
+
+		for (x=0; x<console->cellWidth; x++) {
+			if (consoleCellEqual(&row[x], &drawnRow[x]))
+				continue;
+
+			// an unwritten cell is left alone, unless a glyph drawn there has scrolled away
+			if (row[x].chr == CONSOLE_CELL_UNSET)
+				consoleRenderCell(console, frameBuffer, x, y, &blank);
+			else
+				consoleRenderCell(console, frameBuffer, x, y, &row[x]);
+			drawnRow[x] = row[x];
+		}
+	}
+
+	console->renderPending &= ~BIT(buffer);
+}
+
+// presenting more often than this can't show anything new
+#define CONSOLE_FRAME_TICKS (19200000ULL / 60)
+
+//---------------------------------------------------------------------------------
+static void consolePresent(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+	consoleRender(console, (u32*)gfxGetFramebuffer(NULL, NULL) == console->frameBuffer2 ? 1 : 0);
+
+	gfxFlushBuffers();
+	gfxSwapBuffers();
+
+	console->dirty = false;
+	console->lastPresentTick = svcGetSystemTick();
+}
+
+//---------------------------------------------------------------------------------
+static void consoleMarkDirty(void) {
+//---------------------------------------------------------------------------------
+	currentConsole->dirty = true;
+
+	if (currentConsole->presentMode == ConsolePresent_Immediate) {
+		consoleRender(currentConsole, 0);
+		consoleRender(currentConsole, 1);
+		consolePresent(currentConsole);
+		gfxWaitForVsync();
+	}
+}
+
 //---------------------------------------------------------------------------------
 static void consoleCls(char mode) {
 //---------------------------------------------------------------------------------
@@ -123,9 +334,7 @@ static void consoleCls(char mode) {
 			break;
 		}
 	}
-	gfxFlushBuffers();
-	gfxSwapBuffers();
-	gfxWaitForVsync();
+	consoleMarkDirty();
 }
 //---------------------------------------------------------------------------------
 static void consoleClearLine(char mode) {
@@ -178,9 +387,7 @@ static void consoleClearLine(char mode) {
 			break;
 		}
 	}
-	gfxFlushBuffers();
-	gfxSwapBuffers();
-	gfxWaitForVsync();
+	consoleMarkDirty();
 }
 
 
@@ -208,281 +415,279 @@ static inline void consolePosition(int x, int y) {
 	currentConsole->cursorY = y - 1;
 }
 
+//---------------------------------------------------------------------------------
+static void consoleSetGraphicsRendition(int parameter) {
+//---------------------------------------------------------------------------------
+	switch(parameter) {
+	case 0: // reset
+		currentConsole->flags = 0;
+		currentConsole->bg    = 0;
+		currentConsole->fg    = 7;
+		break;
+
+	case 1: // bold
+		currentConsole->flags &= ~CONSOLE_COLOR_FAINT;
+		currentConsole->flags |= CONSOLE_COLOR_BOLD;
+		break;
+
+	case 2: // faint
+		currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
+		currentConsole->flags |= CONSOLE_COLOR_FAINT;
+		break;
+
+	case 3: // italic
+		currentConsole->flags |= CONSOLE_ITALIC;
+		break;
+
+	case 4: // underline
+		currentConsole->flags |= CONSOLE_UNDERLINE;
+		break;
+
+	case 5: // blink slow
+		currentConsole->flags &= ~CONSOLE_BLINK_FAST;
+		currentConsole->flags |= CONSOLE_BLINK_SLOW;
+		break;
+
+	case 6: // blink fast
+		currentConsole->flags &= ~CONSOLE_BLINK_SLOW;
+		currentConsole->flags |= CONSOLE_BLINK_FAST;
+		break;
+
+	case 7: // reverse video
+		currentConsole->flags |= CONSOLE_COLOR_REVERSE;
+		break;
+
+	case 8: // conceal
+		currentConsole->flags |= CONSOLE_CONCEAL;
+		break;
+
+	case 9: // crossed-out
+		currentConsole->flags |= CONSOLE_CROSSED_OUT;
+		break;
+
+	case 21: // bold off
+		currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
+		break;
+
+	case 22: // normal color
+		currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
+		currentConsole->flags &= ~CONSOLE_COLOR_FAINT;
+		break;
+
+	case 23: // italic off
+		currentConsole->flags &= ~CONSOLE_ITALIC;
+		break;
+
+	case 24: // underline off
+		currentConsole->flags &= ~CONSOLE_UNDERLINE;
+		break;
+
+	case 25: // blink off
+		currentConsole->flags &= ~CONSOLE_BLINK_SLOW;
+		currentConsole->flags &= ~CONSOLE_BLINK_FAST;
+		break;
+
+	case 27: // reverse off
+		currentConsole->flags &= ~CONSOLE_COLOR_REVERSE;
+		break;
+
+	case 29: // crossed-out off
+		currentConsole->flags &= ~CONSOLE_CROSSED_OUT;
+		break;
+
+	case 30 ... 37: // writing color
+		currentConsole->fg = parameter - 30;
+		break;
+
+	case 39: // reset foreground color
+		currentConsole->fg = 7;
+		break;
+
+	case 40 ... 47: // screen color
+		currentConsole->bg = parameter - 40;
+		break;
+
+	case 49: // reset background color
+		currentConsole->bg = 0;
+		break;
+	}
+}
+
+//---------------------------------------------------------------------------------
+static int consoleEscParam(int index, int fallback) {
+//---------------------------------------------------------------------------------
+	if (index >= currentConsole->escParamCount || currentConsole->escParams[index] < 0)
+		return fallback;
+
+	return currentConsole->escParams[index];
+}
+
+//---------------------------------------------------------------------------------
+static void consoleEscDispatch(char cmd) {
+//---------------------------------------------------------------------------------
+	int parameter, i;
+	int count = currentConsole->escParamCount;
+
+	switch (cmd) {
+		//---------------------------------------
+		// Cursor directional movement
+		//---------------------------------------
+		case 'A':
+			parameter = consoleEscParam(0, 1);
+			currentConsole->cursorY  =  (currentConsole->cursorY  - parameter) < 0 ? 0 : currentConsole->cursorY  - parameter;
+			break;
+		case 'B':
+			parameter = consoleEscParam(0, 1);
+			currentConsole->cursorY  =  (currentConsole->cursorY  + parameter) > currentConsole->windowHeight - 1 ? currentConsole->windowHeight - 1 : currentConsole->cursorY  + parameter;
+			break;
+		case 'C':
+			parameter = consoleEscParam(0, 1);
+			currentConsole->cursorX  =  (currentConsole->cursorX  + parameter) > currentConsole->windowWidth - 1 ? currentConsole->windowWidth - 1 : currentConsole->cursorX  + parameter;
+			break;
+		case 'D':
+			parameter = consoleEscParam(0, 1);
+			currentConsole->cursorX  =  (currentConsole->cursorX  - parameter) < 0 ? 0 : currentConsole->cursorX  - parameter;
+			break;
+		//---------------------------------------
+		// Cursor position movement
+		//---------------------------------------
+		case 'H':
+		case 'f':
+			consolePosition(consoleEscParam(1, 1), consoleEscParam(0, 1));
+			break;
+		//---------------------------------------
+		// Screen clear
+		//---------------------------------------
+		case 'J':
+			parameter = consoleEscParam(0, 0);
+			if (count <= 1 && parameter <= 2)
+				consoleCls('0' + parameter);
+			break;
+		//---------------------------------------
+		// Line clear
+		//---------------------------------------
+		case 'K':
+			parameter = consoleEscParam(0, 0);
+			if (count <= 1 && parameter <= 2)
+				consoleClearLine('0' + parameter);
+			break;
+		//---------------------------------------
+		// Save cursor position
+		//---------------------------------------
+		case 's':
+			if (count == 0) {
+				currentConsole->prevCursorX  = currentConsole->cursorX ;
+				currentConsole->prevCursorY  = currentConsole->cursorY ;
+			}
+			break;
+		//---------------------------------------
+		// Load cursor position
+		//---------------------------------------
+		case 'u':
+			if (count == 0) {
+				currentConsole->cursorX  = currentConsole->prevCursorX ;
+				currentConsole->cursorY  = currentConsole->prevCursorY ;
+			}
+			break;
+		//---------------------------------------
+		// Color scan codes
+		//---------------------------------------
+		case 'm':
+			if (count == 0)
+				consoleSetGraphicsRendition(0);
+
+			for (i=0; i<count; i++)
+				consoleSetGraphicsRendition(consoleEscParam(i, 0));
+			break;
+
+		default:
+			// some sort of unsupported escape; just gloss over it
+			break;
+	}
+}
+
 //---------------------------------------------------------------------------------
 static ssize_t con_write(struct _reent *r,void *fd,const char *ptr, size_t len) {
 //---------------------------------------------------------------------------------
 
 	char chr;
+	size_t i;
 
-	int i, count = 0;
-	char *tmp = (char*)ptr;
-
-	if(!tmp) return -1;
-
-	i = 0;
-
-	while(i<len) {
-
-		chr = *(tmp++);
-		i++; count++;
-
-		if ( chr == 0x1b && *tmp == '[' ) {
-			bool escaping = true;
-			char *escapeseq	= tmp++;
-			int escapelen = 1;
-			i++; count++;
-
-			do {
-				chr = *(tmp++);
-				i++; count++; escapelen++;
-				int parameter, assigned, consumed;
-
-				// make sure parameters are positive values and delimited by semicolon
-				if((chr >= '0' && chr <= '9') || chr == ';')
-					continue;
-
-				switch (chr) {
-					//---------------------------------------
-					// Cursor directional movement
-					//---------------------------------------
-					case 'A':
-						consumed = 0;
-						assigned = sscanf(escapeseq,"[%dA%n", &parameter, &consumed);
-						if (assigned==0) parameter = 1;
-						if (consumed)
-							currentConsole->cursorY  =  (currentConsole->cursorY  - parameter) < 0 ? 0 : currentConsole->cursorY  - parameter;
-						escaping = false;
-						break;
-					case 'B':
-						consumed = 0;
-						assigned = sscanf(escapeseq,"[%dB%n", &parameter, &consumed);
-						if (assigned==0) parameter = 1;
-						if (consumed)
-							currentConsole->cursorY  =  (currentConsole->cursorY  + parameter) > currentConsole->windowHeight - 1 ? currentConsole->windowHeight - 1 : currentConsole->cursorY  + parameter;
-						escaping = false;
-						break;
-					case 'C':
-						consumed = 0;
-						assigned = sscanf(escapeseq,"[%dC%n", &parameter, &consumed);
-						if (assigned==0) parameter = 1;
-						if (consumed)
-							currentConsole->cursorX  =  (currentConsole->cursorX  + parameter) > currentConsole->windowWidth - 1 ? currentConsole->windowWidth - 1 : currentConsole->cursorX  + parameter;
-						escaping = false;
-						break;
-					case 'D':
-						consumed = 0;
-						assigned = sscanf(escapeseq,"[%dD%n", &parameter, &consumed);
-						if (assigned==0) parameter = 1;
-						if (consumed)
-							currentConsole->cursorX  =  (currentConsole->cursorX  - parameter) < 0 ? 0 : currentConsole->cursorX  - parameter;
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Cursor position movement
-					//---------------------------------------
-					case 'H':
-					case 'f':
-					{
-						int  x, y;
-						char c;
-						if(sscanf(escapeseq,"[%d;%d%c", &y, &x, &c) == 3 && (c == 'f' || c == 'H')) {
-							consolePosition(x, y);
-							escaping = false;
-							break;
-						}
-
-						x = y = 1;
-						if(sscanf(escapeseq,"[%d;%c", &y, &c) == 2 && (c == 'f' || c == 'H')) {
-							consolePosition(x, y);
-							escaping = false;
-							break;
-						}
-
-						x = y = 1;
-						if(sscanf(escapeseq,"[;%d%c", &x, &c) == 2 && (c == 'f' || c == 'H')) {
-							consolePosition(x, y);
-							escaping = false;
-							break;
-						}
-
-						x = y = 1;
-						if(sscanf(escapeseq,"[;%c", &c) == 1 && (c == 'f' || c == 'H')) {
-							consolePosition(x, y);
-							escaping = false;
-							break;
-						}
-
-						// invalid format
-						escaping = false;
-						break;
-					}
-					//---------------------------------------
-					// Screen clear
-					//---------------------------------------
-					case 'J':
-						if(escapelen <= 3)
-							consoleCls(escapeseq[escapelen-2]);
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Line clear
-					//---------------------------------------
-					case 'K':
-						if(escapelen <= 3)
-							consoleClearLine(escapeseq[escapelen-2]);
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Save cursor position
-					//---------------------------------------
-					case 's':
-						if(escapelen == 2) {
-							currentConsole->prevCursorX  = currentConsole->cursorX ;
-							currentConsole->prevCursorY  = currentConsole->cursorY ;
-						}
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Load cursor position
-					//---------------------------------------
-					case 'u':
-						if(escapelen == 2) {
-							currentConsole->cursorX  = currentConsole->prevCursorX ;
-							currentConsole->cursorY  = currentConsole->prevCursorY ;
-						}
-						escaping = false;
-						break;
-					//---------------------------------------
-					// Color scan codes
-					//---------------------------------------
-					case 'm':
-						escapeseq++;
-						escapelen--;
-
-						do {
-							parameter = 0;
-							if (escapelen == 1) {
-								consumed = 1;
-							} else if (memchr(escapeseq,';',escapelen)) {
-								sscanf(escapeseq,"%d;%n", &parameter, &consumed);
-							} else {
-								sscanf(escapeseq,"%dm%n", &parameter, &consumed);
-							}
-
-							escapeseq += consumed;
-							escapelen -= consumed;
-
-							switch(parameter) {
-							case 0: // reset
-								currentConsole->flags = 0;
-								currentConsole->bg    = 0;
-								currentConsole->fg    = 7;
-								break;
-
-							case 1: // bold
-								currentConsole->flags &= ~CONSOLE_COLOR_FAINT;
-								currentConsole->flags |= CONSOLE_COLOR_BOLD;
-								break;
-
-							case 2: // faint
-								currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
-								currentConsole->flags |= CONSOLE_COLOR_FAINT;
-								break;
-
-							case 3: // italic
-								currentConsole->flags |= CONSOLE_ITALIC;
-								break;
-
-							case 4: // underline
-								currentConsole->flags |= CONSOLE_UNDERLINE;
-								break;
-
-							case 5: // blink slow
-								currentConsole->flags &= ~CONSOLE_BLINK_FAST;
-								currentConsole->flags |= CONSOLE_BLINK_SLOW;
-								break;
-
-							case 6: // blink fast
-								currentConsole->flags &= ~CONSOLE_BLINK_SLOW;
-								currentConsole->flags |= CONSOLE_BLINK_FAST;
-								break;
-
-							case 7: // reverse video
-								currentConsole->flags |= CONSOLE_COLOR_REVERSE;
-								break;
-
-							case 8: // conceal
-								currentConsole->flags |= CONSOLE_CONCEAL;
-								break;
-
-							case 9: // crossed-out
-								currentConsole->flags |= CONSOLE_CROSSED_OUT;
-								break;
-
-							case 21: // bold off
-								currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
-								break;
-
-							case 22: // normal color
-								currentConsole->flags &= ~CONSOLE_COLOR_BOLD;
-								currentConsole->flags &= ~CONSOLE_COLOR_FAINT;
-								break;
-
-							case 23: // italic off
-								currentConsole->flags &= ~CONSOLE_ITALIC;
-								break;
-
-							case 24: // underline off
-								currentConsole->flags &= ~CONSOLE_UNDERLINE;
-								break;
-
-							case 25: // blink off
-								currentConsole->flags &= ~CONSOLE_BLINK_SLOW;
-								currentConsole->flags &= ~CONSOLE_BLINK_FAST;
-								break;
-
-							case 27: // reverse off
-								currentConsole->flags &= ~CONSOLE_COLOR_REVERSE;
-								break;
-
-							case 29: // crossed-out off
-								currentConsole->flags &= ~CONSOLE_CROSSED_OUT;
-								break;
-
-							case 30 ... 37: // writing color
-								currentConsole->fg = parameter - 30;
-								break;
-
-							case 39: // reset foreground color
-								currentConsole->fg = 7;
-								break;
-
-							case 40 ... 47: // screen color
-								currentConsole->bg = parameter - 40;
-								break;
-
-							case 49: // reset background color
-								currentConsole->fg = 0;
-								break;
-							}
-						} while (escapelen > 0);
-
-						escaping = false;
-						break;
-
-					default:
-						// some sort of unsupported escape; just gloss over it
-						escaping = false;
-						break;
-				}
-			} while (escaping);
-			continue;
+	if(!ptr) return -1;
+
+	// escape sequences can be split across writes, so the parser state lives in the console
+	for (i=0; i<len; i++) {
+
+		chr = ptr[i];
+
+		switch (currentConsole->escState) {
+		case CONSOLE_ESC_NONE:
+			if (chr == 0x1b)
+				currentConsole->escState = CONSOLE_ESC_START;
+			else
+				consolePrintChar(chr);
+			break;
+
+		case CONSOLE_ESC_START:
+			if (chr == '[') {
+				currentConsole->escState = CONSOLE_ESC_CSI;
+				currentConsole->escParamCount = 0;
+				currentConsole->escIgnore = false;
+				break;
+			}
+
+			// not a control sequence, print it as is
+			currentConsole->escState = CONSOLE_ESC_NONE;
+			consolePrintChar(0x1b);
+			if (chr == 0x1b)
+				currentConsole->escState = CONSOLE_ESC_START;
+			else
+				consolePrintChar(chr);
+			break;
+
+		case CONSOLE_ESC_CSI:
+			if (chr >= '0' && chr <= '9') {
+				if (currentConsole->escParamCount == 0)
+					currentConsole->escParams[currentConsole->escParamCount++] = -1;
+
+				int *param = &currentConsole->escParams[currentConsole->escParamCount-1];
+				if (*param < 0)
+					*param = 0;
+				if (*param < 10000)
+					*param = *param * 10 + (chr - '0');
+			} else if (chr == ';') {
+				if (currentConsole->escParamCount == 0)
+					currentConsole->escParams[currentConsole->escParamCount++] = -1;
+
+				// sequences with too many parameters are ignored
+				if (currentConsole->escParamCount < CONSOLE_ESC_MAX_PARAMS)
+					currentConsole->escParams[currentConsole->escParamCount++] = -1;
+				else
+					currentConsole->escIgnore = true;
+			} else if (chr >= 0x20 && chr <= 0x3f) {
+				// private parameters and intermediate bytes aren't supported
+				currentConsole->escIgnore = true;
+			} else {
+				currentConsole->escState = CONSOLE_ESC_NONE;
+				if (!currentConsole->escIgnore)
+					consoleEscDispatch(chr);
+			}
+			break;
 		}
+	}
 
-		consolePrintChar(chr);
+	// unless only consoleUpdate presents, the application may swap buffers itself
+	if (currentConsole->presentMode != ConsolePresent_Manual) {
+		consoleRender(currentConsole, 0);
+		consoleRender(currentConsole, 1);
 	}
 
-	return count;
+	// presenting sooner couldn't show anything new, the output stays pending for the next write or consoleUpdate
+	if (currentConsole->dirty && currentConsole->presentMode == ConsolePresent_Auto
+	&& svcGetSystemTick() - currentConsole->lastPresentTick >= CONSOLE_FRAME_TICKS)
+		consolePresent(currentConsole);
+
+	return len;
 }
 
 static const devoptab_t dotab_stdout = {
@@ -548,10 +753,28 @@ PrintConsole* consoleInit(PrintConsole* console) {
 		console = currentConsole;
 	}
 
+	// keep the cell buffers of a console that is initialized again
+	bool keepCells = consoleOwnsCells(console);
+	PrintConsole old;
+
+	if(keepCells) old = *console;
+
 	*currentConsole = defaultConsole;
 
+	if(keepCells) {
+		console->cells         = old.cells;
+		console->drawnCells[0] = old.drawnCells[0];
+		console->drawnCells[1] = old.drawnCells[1];
+		console->cellWidth     = old.cellWidth;
+		console->cellHeight    = old.cellHeight;
+	}
+
 	console->consoleInitialised = 1;
 
+	// frameBuffer/frameBuffer2 and drawnCells track exactly two framebuffers
+	if (g_gfx_framebuf_count > 2)
+		fatalSimple(MAKERESULT(Module_Libnx, LibnxError_BadInput));
+
 	gfxSetMode(GfxMode_TiledDouble);
 
 	console->frameBuffer  = (u32*)gfxGetFramebuffer(NULL, NULL);
@@ -562,7 +785,10 @@ PrintConsole* consoleInit(PrintConsole* console) {
 	gfxSwapBuffers();
 	gfxWaitForVsync();
 
+	consoleAllocCells(console);
 	consoleCls('2');
+	consoleRender(console, 0);
+	consoleRender(console, 1);
 
 	return currentConsole;
 
@@ -607,6 +833,8 @@ void consoleSetFont(PrintConsole* console, ConsoleFont* font){
 
 	console->font = *font;
 
+	if(console->cells) consoleInvalidate(console);
+
 }
 
 //---------------------------------------------------------------------------------
@@ -620,23 +848,10 @@ static void newRow(void) {
 	if(currentConsole->cursorY  >= currentConsole->windowHeight)  {
 		currentConsole->cursorY --;
 
-		int i,j;
-		u32 x, y;
-
-		x = currentConsole->windowX * 16;
-		y = currentConsole->windowY * 16;
-
-		for (i=0; i<currentConsole->windowWidth*16; i++) {
-			u32 *from;
-			u32 *to;
-			for (j=0;j<(currentConsole->windowHeight-1)*16;j++) {
-				to = &currentConsole->frameBuffer[gfxGetFramebufferDisplayOffset(x + i, y + j)];
-				from = &currentConsole->frameBuffer[gfxGetFramebufferDisplayOffset(x + i, y + 16 + j)];
-				*to = *from;
-				to = &currentConsole->frameBuffer2[gfxGetFramebufferDisplayOffset(x + i, y + j)];
-				from = &currentConsole->frameBuffer2[gfxGetFramebufferDisplayOffset(x + i, y + 16 + j)];
-				*to = *from;
-			}
+		// the top row becomes the bottom one, consoleRender moves the pixels
+		if (currentConsole->cells) {
+			currentConsole->cellHead = (currentConsole->cellHead + 1) % currentConsole->cellHeight;
+			currentConsole->renderPending = 3;
 		}
 
 		consoleClearLine('2');
@@ -648,7 +863,10 @@ void consoleDrawChar(int c) {
 	c -= currentConsole->font.asciiOffset;
 	if ( c < 0 || c > currentConsole->font.numChars ) return;
 
-	u16 *fontdata = currentConsole->font.gfx + (16 * c);
+	if (currentConsole->cells == NULL
+	|| currentConsole->cursorX < 0 || currentConsole->cursorX >= currentConsole->cellWidth
+	|| currentConsole->cursorY < 0 || currentConsole->cursorY >= currentConsole->cellHeight)
+		return;
 
 	int writingColor = currentConsole->fg;
 	int screenColor = currentConsole->bg;
@@ -665,44 +883,15 @@ void consoleDrawChar(int c) {
 		screenColor = tmp;
 	}
 
-	u32 bg = colorTable[screenColor];
-	u32 fg = colorTable[writingColor];
-
-	u128 *tmp = (u128*)fontdata;
-
-	u128 bvaltop = tmp[0];
-	u128 bvalbtm = tmp[1];
-
-	if (currentConsole->flags & CONSOLE_UNDERLINE)  bvalbtm |= (u128)0xffffULL << 7*16;
+	ConsoleCell* cell = consoleCellAt(currentConsole, currentConsole->cursorX, currentConsole->cursorY);
 
-	if (currentConsole->flags & CONSOLE_CROSSED_OUT) bvaltop |= (u128)0xffffULL << 7*16;
-
-	u16 mask = 0x8000;
-
-	int i, j;
-
-	int x = (currentConsole->cursorX + currentConsole->windowX) * 16;
-	int y = ((currentConsole->cursorY + currentConsole->windowY) *16 );
-
-	u32 *screen;
-
-	for (i=0;i<16;i++) {
-		for (j=0;j<8;j++) {
-			uint32_t screenOffset = gfxGetFramebufferDisplayOffset(x + i, y + j);
-			screen = &currentConsole->frameBuffer[screenOffset];
-			if (bvaltop >> (16*j) & mask) { *screen = fg; }else{ *screen = bg; }
-			screen = &currentConsole->frameBuffer2[screenOffset];
-			if (bvaltop >> (16*j) & mask) { *screen = fg; }else{ *screen = bg; }
-
-			screenOffset = gfxGetFramebufferDisplayOffset(x + i, y + j + 8);
-			screen = &currentConsole->frameBuffer[screenOffset];
-			if (bvalbtm >> (16*j) & mask) { *screen = fg; }else{ *screen = bg; }
-			screen = &currentConsole->frameBuffer2[screenOffset];
-			if (bvalbtm >> (16*j) & mask) { *screen = fg; }else{ *screen = bg; }
-		}
-		mask >>= 1;
-	}
+	cell->chr  = c;
+	cell->fg   = writingColor;
+	cell->bg   = screenColor;
+	cell->deco = currentConsole->flags & (CONSOLE_UNDERLINE | CONSOLE_CROSSED_OUT);
 
+	currentConsole->dirty = true;
+	currentConsole->renderPending = 3;
 }
 
 //---------------------------------------------------------------------------------
@@ -752,9 +941,7 @@ void consolePrintChar(int c) {
 			newRow();
 		case 13:
 			currentConsole->cursorX  = 0;
-			gfxFlushBuffers();
-			gfxSwapBuffers();
-			gfxWaitForVsync();
+			consoleMarkDirty();
 			break;
 		default:
 			consoleDrawChar(c);
@@ -763,6 +950,27 @@ void consolePrintChar(int c) {
 	}
 }
 
+//---------------------------------------------------------------------------------
+void consoleSetPresentMode(PrintConsole* console, ConsolePresentMode mode) {
+//---------------------------------------------------------------------------------
+
+	if(!console) console = currentConsole;
+
+	console->presentMode = mode;
+
+}
+
+//---------------------------------------------------------------------------------
+void consoleUpdate(PrintConsole* console) {
+//---------------------------------------------------------------------------------
+
+	if(!console) console = currentConsole;
+
+	consolePresent(console);
+	gfxWaitForVsync();
+
+}
+
 //---------------------------------------------------------------------------------
 void consoleClear(void) {
 //---------------------------------------------------------------------------------
@@ -783,6 +991,8 @@ void consoleSetWindow(PrintConsole* console, int x, int y, int width, int height
 	console->cursorX = 0;
 	console->cursorY = 0;
 
+	if(console->consoleInitialised) consoleAllocCells(console);
+
 }
 
 
@@ -1,6 +1,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <malloc.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/dirent.h>
@@ -11,6 +12,10 @@
 #include "runtime/devices/fs_dev.h"
 #include "runtime/util/utf.h"
 #include "services/fs.h"
+#include "arm/atomics.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
+#include "kernel/thread.h"
 
 
 /*! @internal
@@ -25,9 +30,7 @@ static int fsdev_translate_error(Result error);
 static int       fsdev_open(struct _reent *r, void *fileStruct, const char *path, int flags, int mode);
 static int       fsdev_close(struct _reent *r, void *fd);
 static ssize_t   fsdev_write(struct _reent *r, void *fd, const char *ptr, size_t len);
-static ssize_t   fsdev_write_safe(struct _reent *r, void *fd, const char *ptr, size_t len);
 static ssize_t   fsdev_read(struct _reent *r, void *fd, char *ptr, size_t len);
-static ssize_t   fsdev_read_safe(struct _reent *r, void *fd, char *ptr, size_t len);
 static off_t     fsdev_seek(struct _reent *r, void *fd, off_t pos, int dir);
 static int       fsdev_fstat(struct _reent *r, void *fd, struct stat *st);
 static int       fsdev_stat(struct _reent *r, const char *file, struct stat *st);
@@ -53,10 +56,30 @@ static int       fsdev_rmdir(struct _reent *r, const char *name);
 typedef struct
 {
   FsFile fd;
-  int    flags;  /*! Flags used in open(2) */
-  u64    offset; /*! Current file offset */
+  int    flags;        /*! Flags used in open(2) */
+  u64    offset;       /*! Current file offset */
+  char   *wbuf;        /*! Write-back buffer, allocated on first buffered write */
+  size_t wbuf_size;    /*! Write-back buffer capacity, 0 if disabled */
+  size_t wbuf_len;     /*! Number of pending bytes in the write-back buffer */
+  u64    wbuf_offset;  /*! File offset of the pending bytes */
+  bool   append_valid; /*! For O_APPEND, whether offset is known to be the end of the file */
+  char   *rbuf;        /*! Read-ahead buffer, allocated on first buffered read */
+  size_t rbuf_size;    /*! Read-ahead buffer capacity, 0 if disabled */
+  size_t rbuf_len;     /*! Number of valid bytes in the read-ahead buffer */
+  u64    rbuf_offset;  /*! File offset of the read-ahead buffer contents */
+  size_t ra_window;    /*! Current read-ahead window */
+  u64    ra_next;      /*! Offset following the previous read */
 } fsdev_file_t;
 
+/*! Initial read-ahead window, doubled on every sequential refill up to the buffer size */
+#define FSDEV_READAHEAD_MIN 0x4000
+
+static ssize_t   fsdev_write_at(struct _reent *r, fsdev_file_t *file, u64 offset, const char *ptr, size_t len);
+static ssize_t   fsdev_write_safe(struct _reent *r, fsdev_file_t *file, u64 offset, const char *ptr, size_t len);
+static ssize_t   fsdev_read_buffered(struct _reent *r, fsdev_file_t *file, char *ptr, size_t len);
+static ssize_t   fsdev_read_at(struct _reent *r, fsdev_file_t *file, u64 offset, char *ptr, size_t len);
+static ssize_t   fsdev_read_safe(struct _reent *r, fsdev_file_t *file, u64 offset, char *ptr, size_t len);
+
 /*! fsdev devoptab */
 static devoptab_t
 fsdev_devoptab =
@@ -95,6 +118,9 @@ typedef struct
     devoptab_t device;
     FsFileSystem fs;
     char name[32];
+    size_t write_buffer_size;
+    size_t read_ahead_size;
+    size_t dir_batch_size;
 } fsdev_fsdevice;
 
 static bool fsdev_initialised = false;
@@ -102,6 +128,26 @@ static s32 fsdev_fsdevice_default = -1;
 static s32 fsdev_fsdevice_cwd = -1;
 static fsdev_fsdevice fsdev_fsdevices[32];
 
+/*! Bounce buffers used when FS rejects the caller's buffer (0xD401), shared by all threads */
+#define FSDEV_BOUNCE_POOL_SIZE 2
+
+typedef struct
+{
+  char   *buf;
+  size_t size;
+  bool   busy;
+} fsdev_bounce_t;
+
+static Mutex          fsdev_bounce_mutex;
+static CondVar        fsdev_bounce_cond = { 0, &fsdev_bounce_mutex };
+static size_t         fsdev_bounce_size = 0x40000;
+static fsdev_bounce_t fsdev_bounce_pool[FSDEV_BOUNCE_POOL_SIZE];
+static FsdevBounceStats fsdev_bounce_stats;
+
+static u64 fsdev_wbuf_writes;        /*! Writes stored in a write-back buffer */
+static u64 fsdev_wbuf_flushes;       /*! fsFileWrite calls issued to flush write-back buffers */
+static u64 fsdev_wbuf_sizes_skipped; /*! fsFileGetSize calls avoided for O_APPEND */
+
 /*! @endcond */
 
 static char     __cwd[PATH_MAX+1] = "/";
@@ -297,6 +343,9 @@ static int _fsdevMountDevice(const char *name, FsFileSystem fs, fsdev_fsdevice *
   }
 
   device->fs = fs;
+  device->write_buffer_size = 0;
+  device->read_ahead_size = 0;
+  device->dir_batch_size = 32;
   memset(device->name, 0, sizeof(device->name));
   strncpy(device->name, name, sizeof(device->name)-1);
 
@@ -464,6 +513,294 @@ FsFileSystem* fsdevGetDefaultFileSystem(void)
   return &fsdev_fsdevices[fsdev_fsdevice_default].fs;
 }
 
+/*! Get the fsdev file struct of a file descriptor, NULL if it doesn't belong to fsdev */
+static fsdev_file_t* fsdev_get_file(int fd)
+{
+  __handle *handle = __get_handle(fd);
+  if(handle == NULL || devoptab_list[handle->device]->open_r != fsdev_open)
+    return NULL;
+
+  return (fsdev_file_t*)handle->fileStruct;
+}
+
+/*! Write out the pending contents of the write-back buffer */
+static Result fsdev_flush_write_buffer(fsdev_file_t *file)
+{
+  Result rc = 0;
+
+  if(file->wbuf_len == 0)
+    return 0;
+
+  rc = fsFileWrite(&file->fd, file->wbuf_offset, file->wbuf, file->wbuf_len);
+  atomicIncrement64(&fsdev_wbuf_flushes);
+  if(R_SUCCEEDED(rc))
+    file->wbuf_len = 0;
+
+  return rc;
+}
+
+Result fsdevSetDeviceWriteBufferSize(const char *name, size_t size)
+{
+  fsdev_fsdevice *device;
+
+  device = fsdevFindDevice(name);
+  if(device==NULL)
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+  device->write_buffer_size = size;
+  return 0;
+}
+
+int fsdevSetFileWriteBufferSize(int fd, size_t size)
+{
+  Result rc;
+  fsdev_file_t *file = fsdev_get_file(fd);
+
+  if(file == NULL)
+  {
+    errno = EBADF;
+    return -1;
+  }
+
+  if((file->flags & O_ACCMODE) == O_RDONLY)
+  {
+    errno = EBADF;
+    return -1;
+  }
+
+  rc = fsdev_flush_write_buffer(file);
+  if(R_FAILED(rc))
+  {
+    errno = fsdev_translate_error(rc);
+    return -1;
+  }
+
+  free(file->wbuf);
+  file->wbuf         = NULL;
+  file->wbuf_size    = size;
+  file->append_valid = false;
+  return 0;
+}
+
+Result fsdevSetDeviceReadAheadSize(const char *name, size_t size)
+{
+  fsdev_fsdevice *device;
+
+  device = fsdevFindDevice(name);
+  if(device==NULL)
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+  device->read_ahead_size = size;
+  return 0;
+}
+
+Result fsdevSetDeviceDirBatchSize(const char *name, size_t entries)
+{
+  fsdev_fsdevice *device;
+
+  if(entries == 0)
+    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+  device = fsdevFindDevice(name);
+  if(device==NULL)
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+  device->dir_batch_size = entries;
+  return 0;
+}
+
+int fsdevSetFileReadAheadSize(int fd, size_t size)
+{
+  fsdev_file_t *file = fsdev_get_file(fd);
+
+  if(file == NULL || (file->flags & O_ACCMODE) == O_WRONLY)
+  {
+    errno = EBADF;
+    return -1;
+  }
+
+  free(file->rbuf);
+  file->rbuf      = NULL;
+  file->rbuf_size = size;
+  file->rbuf_len  = 0;
+  file->ra_window = 0;
+  return 0;
+}
+
+ssize_t fsdevPread(int fd, void *buf, size_t len, off_t offset)
+{
+  Result rc;
+  ssize_t bytes;
+  size_t bytesRead = 0;
+  struct _reent *r = _REENT;
+  fsdev_file_t *file = fsdev_get_file(fd);
+
+  if(file == NULL || (file->flags & O_ACCMODE) == O_WRONLY)
+  {
+    errno = EBADF;
+    return -1;
+  }
+
+  if(offset < 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  rc = fsdev_flush_write_buffer(file);
+  if(R_FAILED(rc))
+  {
+    errno = fsdev_translate_error(rc);
+    return -1;
+  }
+
+  /* use whatever the read-ahead buffer holds, but leave it alone otherwise */
+  if(file->rbuf_len && (u64)offset >= file->rbuf_offset
+     && (u64)offset - file->rbuf_offset < file->rbuf_len)
+  {
+    size_t avail = file->rbuf_offset + file->rbuf_len - offset;
+    bytesRead = len < avail ? len : avail;
+    memcpy(buf, file->rbuf + (offset - file->rbuf_offset), bytesRead);
+    if(bytesRead == len)
+      return bytesRead;
+  }
+
+  bytes = fsdev_read_at(r, file, offset + bytesRead, (char*)buf + bytesRead, len - bytesRead);
+  if(bytes < 0)
+    return bytesRead ? (ssize_t)bytesRead : -1;
+
+  return bytesRead + bytes;
+}
+
+ssize_t fsdevPwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+  Result rc;
+  struct _reent *r = _REENT;
+  fsdev_file_t *file = fsdev_get_file(fd);
+
+  if(file == NULL || (file->flags & O_ACCMODE) == O_RDONLY)
+  {
+    errno = EBADF;
+    return -1;
+  }
+
+  if(offset < 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* pending writes must land first, and read-ahead data may be overwritten */
+  rc = fsdev_flush_write_buffer(file);
+  if(R_FAILED(rc))
+  {
+    errno = fsdev_translate_error(rc);
+    return -1;
+  }
+  file->rbuf_len     = 0;
+  file->append_valid = false;
+
+  return fsdev_write_at(r, file, offset, (const char*)buf, len);
+}
+
+/*! Take a bounce buffer from the pool, allocating it on first use
+ *
+ *  @returns bounce buffer, or NULL if it could not be allocated
+ */
+static fsdev_bounce_t* fsdev_bounce_acquire(void)
+{
+  fsdev_bounce_t *bounce = NULL;
+
+  mutexLock(&fsdev_bounce_mutex);
+  while(bounce == NULL)
+  {
+    for(u32 i=0; i<FSDEV_BOUNCE_POOL_SIZE && bounce == NULL; i++)
+    {
+      if(!fsdev_bounce_pool[i].busy)
+        bounce = &fsdev_bounce_pool[i];
+    }
+
+    if(bounce == NULL)
+      condvarWait(&fsdev_bounce_cond);
+  }
+
+  if(bounce->buf == NULL || bounce->size != fsdev_bounce_size)
+  {
+    free(bounce->buf);
+    bounce->size = fsdev_bounce_size;
+    bounce->buf  = (char*)memalign(0x1000, bounce->size);
+  }
+
+  if(bounce->buf == NULL)
+    bounce = NULL;
+  else
+    bounce->busy = true;
+  mutexUnlock(&fsdev_bounce_mutex);
+
+  return bounce;
+}
+
+static void fsdev_bounce_release(fsdev_bounce_t *bounce)
+{
+  mutexLock(&fsdev_bounce_mutex);
+  bounce->busy = false;
+  condvarWakeOne(&fsdev_bounce_cond);
+  mutexUnlock(&fsdev_bounce_mutex);
+}
+
+static void fsdev_bounce_account(bool write, const void *ptr, size_t len)
+{
+  mutexLock(&fsdev_bounce_mutex);
+  if(write)
+    fsdev_bounce_stats.write_fallbacks++;
+  else
+    fsdev_bounce_stats.read_fallbacks++;
+  fsdev_bounce_stats.bytes += len;
+  fsdev_bounce_stats.last_buffer = ptr;
+  mutexUnlock(&fsdev_bounce_mutex);
+}
+
+Result fsdevSetBounceBufferSize(size_t size)
+{
+  if(size < 0x1000 || (size & 0xFFF))
+    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+  mutexLock(&fsdev_bounce_mutex);
+  fsdev_bounce_size = size;
+
+  /* idle buffers are reallocated on next use, busy ones when they come back */
+  for(u32 i=0; i<FSDEV_BOUNCE_POOL_SIZE; i++)
+  {
+    if(!fsdev_bounce_pool[i].busy)
+    {
+      free(fsdev_bounce_pool[i].buf);
+      fsdev_bounce_pool[i].buf = NULL;
+    }
+  }
+  mutexUnlock(&fsdev_bounce_mutex);
+
+  return 0;
+}
+
+void fsdevGetBounceStats(FsdevBounceStats *out)
+{
+  mutexLock(&fsdev_bounce_mutex);
+  *out = fsdev_bounce_stats;
+  mutexUnlock(&fsdev_bounce_mutex);
+}
+
+void fsdevGetWriteBufferStats(FsdevWriteBufferStats *out)
+{
+  u64 writes  = __atomic_load_n(&fsdev_wbuf_writes, __ATOMIC_RELAXED);
+  u64 flushes = __atomic_load_n(&fsdev_wbuf_flushes, __ATOMIC_RELAXED);
+  u64 skipped = __atomic_load_n(&fsdev_wbuf_sizes_skipped, __ATOMIC_RELAXED);
+
+  out->buffered_writes      = writes;
+  out->flushes              = flushes;
+  out->size_queries_skipped = skipped;
+  out->ipcs_saved           = (writes > flushes ? writes - flushes : 0) + skipped;
+}
+
 /*! Open a file
  *
  *  @param[in,out] r          newlib reentrancy struct
@@ -557,9 +894,20 @@ fsdev_open(struct _reent *r,
       }
     }
 
-    file->fd     = fd;
-    file->flags  = (flags & (O_ACCMODE|O_APPEND|O_SYNC));
-    file->offset = 0;
+    file->fd           = fd;
+    file->flags        = (flags & (O_ACCMODE|O_APPEND|O_SYNC));
+    file->offset       = 0;
+    file->wbuf         = NULL;
+    file->wbuf_size    = (flags & O_ACCMODE) != O_RDONLY ? device->write_buffer_size : 0;
+    file->wbuf_len     = 0;
+    file->wbuf_offset  = 0;
+    file->append_valid = false;
+    file->rbuf         = NULL;
+    file->rbuf_size    = (flags & O_ACCMODE) != O_WRONLY ? device->read_ahead_size : 0;
+    file->rbuf_len     = 0;
+    file->rbuf_offset  = 0;
+    file->ra_window    = 0;
+    file->ra_next      = 0;
     return 0;
   }
 
@@ -584,6 +932,13 @@ fsdev_close(struct _reent *r,
   /* get pointer to our data */
   fsdev_file_t *file = (fsdev_file_t*)fd;
 
+  /* write out pending data */
+  rc = fsdev_flush_write_buffer(file);
+  free(file->wbuf);
+  file->wbuf = NULL;
+  free(file->rbuf);
+  file->rbuf = NULL;
+
   fsFileClose(&file->fd);
   if(R_SUCCEEDED(rc))
     return 0;
@@ -592,6 +947,92 @@ fsdev_close(struct _reent *r,
   return -1;
 }
 
+/*! Write to an open file through its write-back buffer
+ *
+ *  @param[in,out] r    newlib reentrancy struct
+ *  @param[in,out] file Pointer to fsdev_file_t
+ *  @param[in]     ptr  Pointer to data to write
+ *  @param[in]     len  Length of data to write
+ *
+ *  @returns number of bytes written
+ *  @returns -1 for error
+ */
+static ssize_t
+fsdev_write_buffered(struct _reent *r,
+                     fsdev_file_t  *file,
+                     const char    *ptr,
+                     size_t        len)
+{
+  Result      rc;
+  u64         size;
+
+  if(file->flags & O_APPEND)
+  {
+    /* the end of the file only needs to be queried once, later appends
+     * continue from where the previous one left off */
+    if(file->append_valid)
+      atomicIncrement64(&fsdev_wbuf_sizes_skipped);
+    else
+    {
+      rc = fsFileGetSize(&file->fd, &size);
+      if(R_FAILED(rc))
+      {
+        r->_errno = fsdev_translate_error(rc);
+        return -1;
+      }
+
+      /* pending data may extend the file further */
+      if(file->wbuf_len && file->wbuf_offset + file->wbuf_len > size)
+        size = file->wbuf_offset + file->wbuf_len;
+
+      file->offset       = size;
+      file->append_valid = true;
+    }
+  }
+
+  /* pending data must be contiguous with this write, and there must be room for it */
+  if(file->wbuf_len && (file->wbuf_offset + file->wbuf_len != file->offset
+                        || file->wbuf_len + len > file->wbuf_size))
+  {
+    rc = fsdev_flush_write_buffer(file);
+    if(R_FAILED(rc))
+    {
+      r->_errno = fsdev_translate_error(rc);
+      return -1;
+    }
+  }
+
+  /* large writes go straight to the file */
+  if(len >= file->wbuf_size)
+  {
+    ssize_t written = fsdev_write_at(r, file, file->offset, ptr, len);
+    if(written > 0)
+      file->offset += written;
+
+    return written;
+  }
+
+  if(file->wbuf == NULL)
+  {
+    file->wbuf = (char*)malloc(file->wbuf_size);
+    if(file->wbuf == NULL)
+    {
+      r->_errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  if(file->wbuf_len == 0)
+    file->wbuf_offset = file->offset;
+
+  memcpy(file->wbuf + file->wbuf_len, ptr, len);
+  file->wbuf_len += len;
+  file->offset   += len;
+  atomicIncrement64(&fsdev_wbuf_writes);
+
+  return len;
+}
+
 /*! Write to an open file
  *
  *  @param[in,out] r   newlib reentrancy struct
@@ -609,6 +1050,7 @@ fsdev_write(struct _reent *r,
            size_t        len)
 {
   Result      rc;
+  ssize_t     written;
 
   /* get pointer to our data */
   fsdev_file_t *file = (fsdev_file_t*)fd;
@@ -620,6 +1062,12 @@ fsdev_write(struct _reent *r,
     return -1;
   }
 
+  /* read-ahead data may be overwritten */
+  file->rbuf_len = 0;
+
+  if(file->wbuf_size && !(file->flags & O_SYNC))
+    return fsdev_write_buffered(r, file, ptr, len);
+
   if(file->flags & O_APPEND)
   {
     /* append means write from the end of the file */
@@ -631,17 +1079,42 @@ fsdev_write(struct _reent *r,
     }
   }
 
-  rc = fsFileWrite(&file->fd, file->offset, ptr, len);
+  written = fsdev_write_at(r, file, file->offset, ptr, len);
+  if(written > 0)
+    file->offset += written;
+
+  return written;
+}
+
+/*! Write to an open file at the given offset, without updating the current offset
+ *
+ *  @param[in,out] r      newlib reentrancy struct
+ *  @param[in]     file   Pointer to fsdev_file_t
+ *  @param[in]     offset Offset to write at
+ *  @param[in]     ptr    Pointer to data to write
+ *  @param[in]     len    Length of data to write
+ *
+ *  @returns number of bytes written
+ *  @returns -1 for error
+ */
+static ssize_t
+fsdev_write_at(struct _reent *r,
+              fsdev_file_t  *file,
+              u64           offset,
+              const char    *ptr,
+              size_t        len)
+{
+  Result      rc;
+
+  rc = fsFileWrite(&file->fd, offset, ptr, len);
   if(rc == 0xD401)
-    return fsdev_write_safe(r, fd, ptr, len);
+    return fsdev_write_safe(r, file, offset, ptr, len);
   if(R_FAILED(rc))
   {
     r->_errno = fsdev_translate_error(rc);
     return -1;
   }
 
-  file->offset += len;
-
   /* check if this is synchronous or not */
   if(file->flags & O_SYNC)
     fsFileFlush(&file->fd);
@@ -649,64 +1122,72 @@ fsdev_write(struct _reent *r,
   return len;
 }
 
-/*! Write to an open file
+/*! Write to an open file through an internal buffer
  *
- *  @param[in,out] r   newlib reentrancy struct
- *  @param[in,out] fd  Pointer to fsdev_file_t
- *  @param[in]     ptr Pointer to data to write
- *  @param[in]     len Length of data to write
+ *  @param[in,out] r      newlib reentrancy struct
+ *  @param[in]     file   Pointer to fsdev_file_t
+ *  @param[in]     offset Offset to write at
+ *  @param[in]     ptr    Pointer to data to write
+ *  @param[in]     len    Length of data to write
  *
  *  @returns number of bytes written
  *  @returns -1 for error
  */
 static ssize_t
 fsdev_write_safe(struct _reent *r,
-                void          *fd,
+                fsdev_file_t  *file,
+                u64           offset,
                 const char    *ptr,
                 size_t        len)
 {
-  Result      rc;
+  Result      rc = 0;
   size_t      bytesWritten = 0;
 
-  /* get pointer to our data */
-  fsdev_file_t *file = (fsdev_file_t*)fd;
-
   /* Copy to internal buffer and transfer in chunks.
    * You cannot use FS read/write with certain memory.
    */
-  static __thread char tmp_buffer[8192];
+  fsdev_bounce_account(true, ptr, len);
+  fsdev_bounce_t *bounce = fsdev_bounce_acquire();
+  if(bounce == NULL)
+  {
+    r->_errno = ENOMEM;
+    return -1;
+  }
+
   while(len > 0)
   {
     size_t toWrite = len;
-    if(toWrite > sizeof(tmp_buffer))
-      toWrite = sizeof(tmp_buffer);
+    if(toWrite > bounce->size)
+      toWrite = bounce->size;
 
     /* copy to internal buffer */
-    memcpy(tmp_buffer, ptr, toWrite);
+    memcpy(bounce->buf, ptr, toWrite);
 
     /* write the data */
-    rc = fsFileWrite(&file->fd, file->offset, tmp_buffer, toWrite);
+    rc = fsFileWrite(&file->fd, offset, bounce->buf, toWrite);
 
     if(R_FAILED(rc))
-    {
-      /* return partial transfer */
-      if(bytesWritten > 0)
-        return bytesWritten;
-
-      r->_errno = fsdev_translate_error(rc);
-      return -1;
-    }
+      break;
 
     /* check if this is synchronous or not */
     if(file->flags & O_SYNC)
       fsFileFlush(&file->fd);
 
-    file->offset += toWrite;
+    offset       += toWrite;
     bytesWritten += toWrite;
     ptr          += toWrite;
     len          -= toWrite;
   }
 
+  fsdev_bounce_release(bounce);
+
+  /* return partial transfer */
+  if(R_FAILED(rc) && bytesWritten == 0)
+  {
+    r->_errno = fsdev_translate_error(rc);
+    return -1;
+  }
+
   return bytesWritten;
 }
 
@@ -727,7 +1208,7 @@ fsdev_read(struct _reent *r,
           size_t         len)
 {
   Result      rc;
-  size_t      bytes;
+  ssize_t     bytes;
 
   /* get pointer to our data */
   fsdev_file_t *file = (fsdev_file_t*)fd;
@@ -739,76 +1220,207 @@ fsdev_read(struct _reent *r,
     return -1;
   }
 
-  /* read the data */
-  rc = fsFileRead(&file->fd, file->offset, ptr, len, &bytes);
-  if(rc == 0xD401)
-    return fsdev_read_safe(r, fd, ptr, len);
-  if(R_SUCCEEDED(rc))
+  /* make pending writes visible */
+  rc = fsdev_flush_write_buffer(file);
+  if(R_FAILED(rc))
+  {
+    r->_errno = fsdev_translate_error(rc);
+    return -1;
+  }
+
+  if(file->rbuf_size)
+    return fsdev_read_buffered(r, file, ptr, len);
+
+  /* read the data */
+  bytes = fsdev_read_at(r, file, file->offset, ptr, len);
+  if(bytes > 0)
   {
     /* update current file offset */
     file->offset += bytes;
-    return (ssize_t)bytes;
   }
 
+  return bytes;
+}
+
+/*! Read from an open file through its read-ahead buffer
+ *
+ *  @param[in,out] r    newlib reentrancy struct
+ *  @param[in,out] file Pointer to fsdev_file_t
+ *  @param[out]    ptr  Pointer to buffer to read into
+ *  @param[in]     len  Length of data to read
+ *
+ *  @returns number of bytes read
+ *  @returns -1 for error
+ */
+static ssize_t
+fsdev_read_buffered(struct _reent *r,
+                    fsdev_file_t  *file,
+                    char          *ptr,
+                    size_t        len)
+{
+  ssize_t     bytes;
+  size_t      bytesRead = 0;
+  bool        sequential = file->offset == file->ra_next;
+
+  /* copy what the read-ahead buffer already holds */
+  if(file->rbuf_len && file->offset >= file->rbuf_offset
+     && file->offset - file->rbuf_offset < file->rbuf_len)
+  {
+    size_t avail = file->rbuf_offset + file->rbuf_len - file->offset;
+    bytesRead = len < avail ? len : avail;
+    memcpy(ptr, file->rbuf + (file->offset - file->rbuf_offset), bytesRead);
+
+    file->offset += bytesRead;
+    ptr          += bytesRead;
+    len          -= bytesRead;
+  }
+
+  if(len > 0)
+  {
+    /* the window grows while the file is read sequentially */
+    if(!sequential || file->ra_window == 0)
+      file->ra_window = FSDEV_READAHEAD_MIN < file->rbuf_size ? FSDEV_READAHEAD_MIN : file->rbuf_size;
+    else if(file->ra_window < file->rbuf_size)
+      file->ra_window = file->ra_window*2 < file->rbuf_size ? file->ra_window*2 : file->rbuf_size;
+
+    if(len < file->ra_window && file->rbuf == NULL)
+      file->rbuf = (char*)malloc(file->rbuf_size);
+
+    if(len >= file->ra_window || file->rbuf == NULL)
+    {
+      /* large reads go straight to the caller's buffer */
+      bytes = fsdev_read_at(r, file, file->offset, ptr, len);
+      if(bytes > 0)
+      {
+        file->offset += bytes;
+        bytesRead    += bytes;
+      }
+    }
+    else
+    {
+      file->rbuf_len = 0;
+      bytes = fsdev_read_at(r, file, file->offset, file->rbuf, file->ra_window);
+      if(bytes > 0)
+      {
+        file->rbuf_offset = file->offset;
+        file->rbuf_len    = bytes;
+        if((size_t)bytes > len)
+          bytes = len;
+
+        memcpy(ptr, file->rbuf, bytes);
+        file->offset += bytes;
+        bytesRead    += bytes;
+      }
+    }
+
+    /* report the error unless something was transferred */
+    if(bytes < 0 && bytesRead == 0)
+      return -1;
+  }
+
+  file->ra_next = file->offset;
+  return bytesRead;
+}
+
+/*! Read from an open file at the given offset, without updating the current offset
+ *
+ *  @param[in,out] r      newlib reentrancy struct
+ *  @param[in]     file   Pointer to fsdev_file_t
+ *  @param[in]     offset Offset to read from
+ *  @param[out]    ptr    Pointer to buffer to read into
+ *  @param[in]     len    Length of data to read
+ *
+ *  @returns number of bytes read
+ *  @returns -1 for error
+ */
+static ssize_t
+fsdev_read_at(struct _reent *r,
+             fsdev_file_t  *file,
+             u64           offset,
+             char          *ptr,
+             size_t        len)
+{
+  Result      rc;
+  size_t      bytes;
+
+  rc = fsFileRead(&file->fd, offset, ptr, len, &bytes);
+  if(rc == 0xD401)
+    return fsdev_read_safe(r, file, offset, ptr, len);
+  if(R_SUCCEEDED(rc))
+    return (ssize_t)bytes;
+
   r->_errno = fsdev_translate_error(rc);
   return -1;
 }
 
-/*! Read from an open file
+/*! Read from an open file through an internal buffer
  *
- *  @param[in,out] r   newlib reentrancy struct
- *  @param[in,out] fd  Pointer to fsdev_file_t
- *  @param[out]    ptr Pointer to buffer to read into
- *  @param[in]     len Length of data to read
+ *  @param[in,out] r      newlib reentrancy struct
+ *  @param[in]     file   Pointer to fsdev_file_t
+ *  @param[in]     offset Offset to read from
+ *  @param[out]    ptr    Pointer to buffer to read into
+ *  @param[in]     len    Length of data to read
  *
- *  @returns number of bytes written
+ *  @returns number of bytes read
  *  @returns -1 for error
  */
 static ssize_t
 fsdev_read_safe(struct _reent *r,
-                void          *fd,
+                fsdev_file_t  *file,
+                u64           offset,
                 char          *ptr,
                 size_t        len)
 {
-  Result      rc;
+  Result      rc = 0;
   size_t      bytesRead = 0, bytes = 0;
 
-  /* get pointer to our data */
-  fsdev_file_t *file = (fsdev_file_t*)fd;
-
   /* Transfer in chunks with internal buffer.
    * You cannot use FS read/write with certain memory.
    */
-  static __thread char tmp_buffer[8192];
+  fsdev_bounce_account(false, ptr, len);
+  fsdev_bounce_t *bounce = fsdev_bounce_acquire();
+  if(bounce == NULL)
+  {
+    r->_errno = ENOMEM;
+    return -1;
+  }
+
   while(len > 0)
   {
     size_t toRead = len;
-    if(toRead > sizeof(tmp_buffer))
-      toRead = sizeof(tmp_buffer);
+    if(toRead > bounce->size)
+      toRead = bounce->size;
 
     /* read the data */
-    rc = fsFileRead(&file->fd, file->offset, tmp_buffer, toRead, &bytes);
+    bytes = 0;
+    rc = fsFileRead(&file->fd, offset, bounce->buf, toRead, &bytes);
+
+    if(R_FAILED(rc))
+      break;
 
     if(bytes > toRead)
       bytes = toRead;
 
     /* copy from internal buffer */
-    memcpy(ptr, tmp_buffer, bytes);
-
-    if(R_FAILED(rc))
-    {
-      /* return partial transfer */
-      if(bytesRead > 0)
-        return bytesRead;
-
-      r->_errno = fsdev_translate_error(rc);
-      return -1;
-    }
+    memcpy(ptr, bounce->buf, bytes);
 
-    file->offset += bytes;
+    offset       += bytes;
     bytesRead    += bytes;
     ptr          += bytes;
     len          -= bytes;
+
+    /* stop at end-of-file */
+    if(bytes < toRead)
+      break;
+  }
+
+  fsdev_bounce_release(bounce);
+
+  /* return partial transfer */
+  if(R_FAILED(rc) && bytesRead == 0)
+  {
+    r->_errno = fsdev_translate_error(rc);
+    return -1;
   }
 
   return bytesRead;
@@ -836,6 +1448,20 @@ fsdev_seek(struct _reent *r,
   /* get pointer to our data */
   fsdev_file_t *file = (fsdev_file_t*)fd;
 
+  /* querying the offset (ftell) doesn't affect buffering */
+  if(whence == SEEK_CUR && pos == 0)
+    return file->offset;
+
+  /* write out pending data, the next write may not be contiguous */
+  rc = fsdev_flush_write_buffer(file);
+  if(R_FAILED(rc))
+  {
+    r->_errno = fsdev_translate_error(rc);
+    return -1;
+  }
+  file->append_valid = false;
+  file->rbuf_len     = 0;
+
   /* find the offset to see from */
   switch(whence)
   {
@@ -896,7 +1522,10 @@ fsdev_fstat(struct _reent *r,
   u64         size;
   fsdev_file_t *file = (fsdev_file_t*)fd;
 
-  rc = fsFileGetSize(&file->fd, &size);
+  /* the size must account for pending data */
+  rc = fsdev_flush_write_buffer(file);
+  if(R_SUCCEEDED(rc))
+    rc = fsFileGetSize(&file->fd, &size);
   if(R_SUCCEEDED(rc))
   {
     memset(st, 0, sizeof(struct stat));
@@ -1170,23 +1799,39 @@ fsdev_diropen(struct _reent *r,
   /* get pointer to our data */
   fsdev_dir_t *dir = (fsdev_dir_t*)(dirState->dirStruct);
 
+  dir->entry_data = (FsDirectoryEntry*)malloc(device->dir_batch_size * sizeof(FsDirectoryEntry));
+  if(dir->entry_data == NULL)
+  {
+    r->_errno = ENOMEM;
+    return NULL;
+  }
+
   /* open the directory */
   rc = fsFsOpenDirectory(&device->fs, fs_path, FS_DIROPEN_DIRECTORY | FS_DIROPEN_FILE, &fd);
   if(R_SUCCEEDED(rc))
   {
-    dir->magic = FSDEV_DIRITER_MAGIC;
-    dir->fd    = fd;
-    dir->index = -1;
-    dir->size  = 0;
-    memset(&dir->entry_data, 0, sizeof(dir->entry_data));
+    dir->magic       = FSDEV_DIRITER_MAGIC;
+    dir->fd          = fd;
+    dir->index       = -1;
+    dir->size        = 0;
+    dir->max_entries = device->dir_batch_size;
+    dir->batches     = 0;
+    dir->eof         = false;
+    dir->fs          = &device->fs;
+    memcpy(dir->path, fs_path, sizeof(dir->path));
     return dirState;
   }
 
+  free(dir->entry_data);
+  dir->entry_data = NULL;
   r->_errno = fsdev_translate_error(rc);
   return NULL;
 }
 
 /*! Reset an open directory to its intial state
+ *
+ *  FS directories can't be rewound, so the directory is reopened unless
+ *  all of its entries are still held in the current batch.
  *
  *  @param[in,out] r        newlib reentrancy struct
  *  @param[in]     dirState Pointer to open directory state
@@ -1198,10 +1843,138 @@ static int
 fsdev_dirreset(struct _reent *r,
               DIR_ITER      *dirState)
 {
-  r->_errno = ENOSYS;
+  FsDir   fd;
+  Result  rc;
+
+  /* get pointer to our data */
+  fsdev_dir_t *dir = (fsdev_dir_t*)(dirState->dirStruct);
+
+  /* the whole directory is already in memory */
+  if(dir->eof && dir->batches <= 1)
+  {
+    dir->index = -1;
+    return 0;
+  }
+
+  fsDirClose(&dir->fd);
+
+  dir->index   = -1;
+  dir->size    = 0;
+  dir->batches = 0;
+  dir->eof     = false;
+
+  rc = fsFsOpenDirectory(dir->fs, dir->path, FS_DIROPEN_DIRECTORY | FS_DIROPEN_FILE, &fd);
+  if(R_SUCCEEDED(rc))
+  {
+    dir->fd = fd;
+    return 0;
+  }
+
+  /* leave the directory looking empty until it is closed */
+  dir->eof = true;
+  r->_errno = fsdev_translate_error(rc);
   return -1;
 }
 
+/*! Advance to the next entry of an open directory, reading a new batch if needed
+ *
+ *  @param[in,out] r   newlib reentrancy struct
+ *  @param[in]     dir Pointer to fsdev_dir_t
+ *
+ *  @returns 1 if dir->index points to the next entry
+ *  @returns 0 at end of directory
+ *  @returns -1 for error
+ */
+static int
+fsdev_dir_advance(struct _reent *r,
+                  fsdev_dir_t   *dir)
+{
+  Result  rc;
+  size_t  entries;
+
+  /* check if it's in the batch already */
+  if(dir->index + 1 < (ssize_t)dir->size)
+  {
+    ++dir->index;
+    return 1;
+  }
+
+  /* keep the last batch around so rewinddir can reuse it */
+  dir->index = dir->size;
+  if(dir->eof)
+    return 0;
+
+  /* fetch the next batch */
+  rc = fsDirRead(&dir->fd, 0, &entries, dir->max_entries, dir->entry_data);
+  if(R_FAILED(rc))
+  {
+    r->_errno = fsdev_translate_error(rc);
+    return -1;
+  }
+
+  if(entries == 0)
+  {
+    dir->eof = true;
+    return 0;
+  }
+
+  dir->index = 0;
+  dir->size  = entries;
+  dir->batches++;
+  return 1;
+}
+
+/*! Convert a FS directory entry to a name and stat info
+ *
+ *  @param[in,out] r        newlib reentrancy struct
+ *  @param[in]     entry    Entry to convert
+ *  @param[out]    filename Buffer to store entry name
+ *  @param[out]    filestat Buffer to store entry attributes
+ *
+ *  @returns 0 for success
+ *  @returns -1 for error
+ */
+static int
+fsdev_dir_convert(struct _reent          *r,
+                  const FsDirectoryEntry *entry,
+                  char                   *filename,
+                  struct stat            *filestat)
+{
+  ssize_t units;
+
+  /* fill in the stat info */
+  filestat->st_ino = 0;
+  if(entry->type == ENTRYTYPE_DIR)
+    filestat->st_mode = S_IFDIR;
+  else if(entry->type == ENTRYTYPE_FILE)
+  {
+    filestat->st_mode = S_IFREG;
+    filestat->st_size = entry->fileSize;
+  }
+  else
+  {
+    r->_errno = EINVAL;
+    return -1;
+  }
+
+  /* convert name from fs-path to UTF-8 */
+  units = fsdev_convertfromfspath((uint8_t*)filename, (uint8_t*)entry->name, NAME_MAX);
+  if(units < 0)
+  {
+    r->_errno = EILSEQ;
+    return -1;
+  }
+
+  if(units >= NAME_MAX)
+  {
+    r->_errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  filename[units] = 0;
+  return 0;
+}
+
 /*! Fetch the next entry of an open directory
  *
  *  @param[in,out] r        newlib reentrancy struct
@@ -1218,83 +1991,344 @@ fsdev_dirnext(struct _reent *r,
              char          *filename,
              struct stat   *filestat)
 {
-  Result              rc;
-  size_t              entries;
-  ssize_t             units;
-  FsDirectoryEntry   *entry;
+  int rc;
 
   /* get pointer to our data */
   fsdev_dir_t *dir = (fsdev_dir_t*)(dirState->dirStruct);
 
-  static const size_t max_entries = sizeof(dir->entry_data) / sizeof(dir->entry_data[0]);
+  rc = fsdev_dir_advance(r, dir);
+  if(rc == 0)
+  {
+    /* there are no more entries; ENOENT signals end-of-directory */
+    r->_errno = ENOENT;
+    return -1;
+  }
 
-  /* check if it's in the batch already */
-  if(++dir->index < dir->size)
+  if(rc < 0)
+    return -1;
+
+  return fsdev_dir_convert(r, &dir->entry_data[dir->index], filename, filestat);
+}
+
+int fsdevReadDirBatch(DIR *dirp, FsdevDirEntry *entries, size_t max_entries)
+{
+  struct _reent *r = _REENT;
+  size_t        count = 0;
+  int           rc;
+
+  if(dirp == NULL || dirp->dirData == NULL
+  || devoptab_list[dirp->dirData->device]->dirnext_r != fsdev_dirnext)
+  {
+    r->_errno = EBADF;
+    return -1;
+  }
+
+  fsdev_dir_t *dir = (fsdev_dir_t*)(dirp->dirData->dirStruct);
+
+  while(count < max_entries)
   {
-    rc = 0;
+    rc = fsdev_dir_advance(r, dir);
+    if(rc == 0)
+      break;
+
+    /* return partial batch */
+    if(rc < 0)
+      return count > 0 ? count : -1;
+
+    memset(&entries[count].st, 0, sizeof(entries[count].st));
+    if(fsdev_dir_convert(r, &dir->entry_data[dir->index], entries[count].name, &entries[count].st) == -1)
+      return count > 0 ? count : -1;
+
+    count++;
   }
+
+  return count;
+}
+
+/*! Directory waiting to be read by fsdevWalk */
+typedef struct fsdev_walk_node
+{
+  struct fsdev_walk_node *next;
+  u32                    depth;
+  char                   path[];
+} fsdev_walk_node;
+
+/*! State shared by the fsdevWalk workers */
+typedef struct
+{
+  Mutex             mutex;        /*! Protects the queue and counters */
+  CondVar           cond;         /*! Signalled when the queue grows or the walk ends */
+  Mutex             cb_mutex;     /*! Serializes callback invocations */
+  fsdev_walk_node   *head;
+  fsdev_walk_node   *tail;
+  u32               active;       /*! Number of workers reading a directory */
+  bool              stop;
+  Result            rc;           /*! First error encountered */
+  FsFileSystem      *fs;
+  const char        *device_name;
+  FsdevWalkCallback callback;
+  void              *userdata;
+} fsdev_walk_t;
+
+/*! Queue a directory for reading, called with the walk mutex held
+ *
+ *  @param[in,out] walk  Walk state
+ *  @param[in]     path  FS path of the directory
+ *  @param[in]     len   Length of path
+ *  @param[in]     depth Depth of the directory's entries
+ *
+ *  @returns 0 for success
+ *  @returns -1 for error
+ */
+static int
+fsdev_walk_push(fsdev_walk_t *walk,
+                const char   *path,
+                size_t       len,
+                u32          depth)
+{
+  fsdev_walk_node *node = (fsdev_walk_node*)malloc(sizeof(fsdev_walk_node) + len + 1);
+  if(node == NULL)
+    return -1;
+
+  node->next  = NULL;
+  node->depth = depth;
+  memcpy(node->path, path, len);
+  node->path[len] = 0;
+
+  if(walk->tail)
+    walk->tail->next = node;
   else
+    walk->head = node;
+  walk->tail = node;
+
+  condvarWakeOne(&walk->cond);
+  return 0;
+}
+
+/*! Record the first error of a walk
+ *
+ *  @param[in,out] walk Walk state
+ *  @param[in]     rc   Error
+ */
+static void
+fsdev_walk_error(fsdev_walk_t *walk,
+                 Result       rc)
+{
+  mutexLock(&walk->mutex);
+  if(R_SUCCEEDED(walk->rc))
+    walk->rc = rc;
+  mutexUnlock(&walk->mutex);
+}
+
+/*! Read one directory, reporting its entries and queueing its subdirectories
+ *
+ *  @param[in,out] walk    Walk state
+ *  @param[in]     node    Directory to read
+ *  @param[in]     entries Buffer for FS entries
+ *  @param[in]     max     Capacity of entries
+ *  @param[out]    path    Buffer for full entry paths, PATH_MAX+1 bytes
+ */
+static void
+fsdev_walk_dir(fsdev_walk_t     *walk,
+               fsdev_walk_node  *node,
+               FsDirectoryEntry *entries,
+               size_t           max,
+               char             *path)
+{
+  FsDir           fd;
+  Result          rc;
+  size_t          count, prefix, dir_len, name_len;
+  FsdevWalkEntry  entry;
+  FsdevWalkAction action;
+
+  rc = fsFsOpenDirectory(walk->fs, node->path, FS_DIROPEN_DIRECTORY | FS_DIROPEN_FILE, &fd);
+  if(R_FAILED(rc))
   {
-    /* reset batch info */
-    dir->index = -1;
-    dir->size  = 0;
+    fsdev_walk_error(walk, rc);
+    return;
+  }
+
+  /* full paths are "device:" followed by the FS path */
+  prefix  = strlen(walk->device_name) + 1;
+  dir_len = strlen(node->path);
+  if(dir_len > 0 && node->path[dir_len-1] == '/')
+    dir_len--;
+  memcpy(path, walk->device_name, prefix - 1);
+  path[prefix - 1] = ':';
+  memcpy(path + prefix, node->path, dir_len);
+  path[prefix + dir_len] = '/';
+
+  entry.path  = path;
+  entry.name  = path + prefix + dir_len + 1;
+  entry.depth = node->depth;
+
+  while(!walk->stop)
+  {
+    rc = fsDirRead(&fd, 0, &count, max, entries);
+    if(R_FAILED(rc))
+    {
+      fsdev_walk_error(walk, rc);
+      break;
+    }
+
+    if(count == 0)
+      break;
 
-    /* fetch the next batch */
-    memset(dir->entry_data, 0, sizeof(dir->entry_data));
-    rc = fsDirRead(&dir->fd, 0, &entries, max_entries, dir->entry_data);
-    if(R_SUCCEEDED(rc))
+    for(size_t i = 0; i < count && !walk->stop; i++)
     {
-      if(entries == 0)
+      name_len = strnlen(entries[i].name, sizeof(entries[i].name));
+      if(prefix + dir_len + 1 + name_len > PATH_MAX)
       {
-        /* there are no more entries; ENOENT signals end-of-directory */
-        r->_errno = ENOENT;
-        return -1;
+        fsdev_walk_error(walk, MAKERESULT(Module_Libnx, LibnxError_BadInput));
+        continue;
       }
 
-      dir->index = 0;
-      dir->size  = entries;
+      memcpy(path + prefix + dir_len + 1, entries[i].name, name_len);
+      path[prefix + dir_len + 1 + name_len] = 0;
+
+      entry.is_dir = entries[i].type == ENTRYTYPE_DIR;
+      entry.size   = entry.is_dir ? 0 : entries[i].fileSize;
+
+      mutexLock(&walk->cb_mutex);
+      action = walk->stop ? FsdevWalkAction_Stop : walk->callback(&entry, walk->userdata);
+      mutexUnlock(&walk->cb_mutex);
+
+      mutexLock(&walk->mutex);
+      if(action == FsdevWalkAction_Stop)
+      {
+        walk->stop = true;
+        condvarWakeAll(&walk->cond);
+      }
+      else if(entry.is_dir && action == FsdevWalkAction_Continue
+           && fsdev_walk_push(walk, path + prefix, dir_len + 1 + name_len, node->depth + 1) == -1)
+      {
+        if(R_SUCCEEDED(walk->rc))
+          walk->rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+      }
+      mutexUnlock(&walk->mutex);
     }
   }
 
-  if(R_SUCCEEDED(rc))
+  fsDirClose(&fd);
+}
+
+/*! Take directories off the walk queue until it is drained
+ *
+ *  @param[in,out] arg Walk state
+ */
+static void
+fsdev_walk_worker(void *arg)
+{
+  fsdev_walk_t     *walk = (fsdev_walk_t*)arg;
+  fsdev_walk_node  *node;
+  FsDirectoryEntry *entries;
+  char             *path;
+  const size_t     max = 32;
+
+  entries = (FsDirectoryEntry*)malloc(max * sizeof(FsDirectoryEntry));
+  path    = (char*)malloc(PATH_MAX+1);
+  if(entries == NULL || path == NULL)
   {
-    entry = &dir->entry_data[dir->index];
+    free(entries);
+    free(path);
+    fsdev_walk_error(walk, MAKERESULT(Module_Libnx, LibnxError_OutOfMemory));
+    return;
+  }
 
-    /* fill in the stat info */
-    filestat->st_ino = 0;
-    if(entry->type == ENTRYTYPE_DIR)
-      filestat->st_mode = S_IFDIR;
-    else if(entry->type == ENTRYTYPE_FILE)
-    {
-      filestat->st_mode = S_IFREG;
-      filestat->st_size = entry->fileSize;
-    }
-    else
-    {
-      r->_errno = EINVAL;
-      return -1;
-    }
+  mutexLock(&walk->mutex);
+  for(;;)
+  {
+    /* the walk is over once nothing is queued and nobody can queue more */
+    while(walk->head == NULL && walk->active > 0 && !walk->stop)
+      condvarWait(&walk->cond);
 
-    /* convert name from fs-path to UTF-8 */
-    memset(filename, 0, NAME_MAX);
-    units = fsdev_convertfromfspath((uint8_t*)filename, (uint8_t*)entry->name, NAME_MAX);
-    if(units < 0)
-    {
-      r->_errno = EILSEQ;
-      return -1;
-    }
+    if(walk->head == NULL || walk->stop)
+      break;
+
+    node = walk->head;
+    walk->head = node->next;
+    if(walk->head == NULL)
+      walk->tail = NULL;
+    walk->active++;
+    mutexUnlock(&walk->mutex);
+
+    fsdev_walk_dir(walk, node, entries, max, path);
+    free(node);
+
+    mutexLock(&walk->mutex);
+    walk->active--;
+  }
+
+  condvarWakeAll(&walk->cond);
+  mutexUnlock(&walk->mutex);
+
+  free(entries);
+  free(path);
+}
+
+Result fsdevWalk(const char *path, u32 num_workers, FsdevWalkCallback callback, void *userdata)
+{
+  struct _reent   *r = _REENT;
+  fsdev_fsdevice  *device = NULL;
+  char            fs_path[FS_MAX_PATH];
+  fsdev_walk_t    walk;
+  fsdev_walk_node *node;
+  Thread          threads[8];
+  u32             num_threads = 0;
+
+  if(callback == NULL)
+    return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+  if(fsdev_getfspath(r, path, &device, fs_path)==-1)
+    return MAKERESULT(Module_Libnx, r->_errno == ENODEV ? LibnxError_NotFound : LibnxError_BadInput);
+
+  memset(&walk, 0, sizeof(walk));
+  mutexInit(&walk.mutex);
+  condvarInit(&walk.cond, &walk.mutex);
+  mutexInit(&walk.cb_mutex);
+  walk.fs          = &device->fs;
+  walk.device_name = device->name;
+  walk.callback    = callback;
+  walk.userdata    = userdata;
+
+  if(fsdev_walk_push(&walk, fs_path, strlen(fs_path), 0) == -1)
+    return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
 
-    if(units >= NAME_MAX)
+  /* the calling thread is one of the workers */
+  if(num_workers > sizeof(threads)/sizeof(threads[0]) + 1)
+    num_workers = sizeof(threads)/sizeof(threads[0]) + 1;
+
+  for(u32 i = 1; i < num_workers; i++)
+  {
+    if(R_FAILED(threadCreate(&threads[num_threads], fsdev_walk_worker, &walk, 0x4000, 0x2C, -2)))
+      break;
+
+    if(R_FAILED(threadStart(&threads[num_threads])))
     {
-      r->_errno = ENAMETOOLONG;
-      return -1;
+      threadClose(&threads[num_threads]);
+      break;
     }
 
-    return 0;
+    num_threads++;
   }
 
-  r->_errno = fsdev_translate_error(rc);
-  return -1;
+  fsdev_walk_worker(&walk);
+
+  for(u32 i = 0; i < num_threads; i++)
+  {
+    threadWaitForExit(&threads[i]);
+    threadClose(&threads[i]);
+  }
+
+  /* left over after a stop */
+  while(walk.head)
+  {
+    node = walk.head;
+    walk.head = node->next;
+    free(node);
+  }
+
+  return walk.rc;
 }
 
 /*! Close an open directory
@@ -1316,6 +2350,8 @@ fsdev_dirclose(struct _reent *r,
 
   /* close the directory */
   fsDirClose(&dir->fd);
+  free(dir->entry_data);
+  dir->entry_data = NULL;
   if(R_SUCCEEDED(rc))
     return 0;
 
@@ -1397,8 +2433,14 @@ fsdev_ftruncate(struct _reent *r,
     return -1;
   }
 
+  /* pending data must not land beyond the new end of the file */
+  rc = fsdev_flush_write_buffer(file);
+  file->append_valid = false;
+  file->rbuf_len     = 0;
+
   /* set the new file size */
-  rc = fsFileSetSize(&file->fd, len);
+  if(R_SUCCEEDED(rc))
+    rc = fsFileSetSize(&file->fd, len);
   if(R_SUCCEEDED(rc))
     return 0;
 
@@ -1423,7 +2465,9 @@ fsdev_fsync(struct _reent *r,
   /* get pointer to our data */
   fsdev_file_t *file = (fsdev_file_t*)fd;
 
-  rc = fsFileFlush(&file->fd);
+  rc = fsdev_flush_write_buffer(file);
+  if(R_SUCCEEDED(rc))
+    rc = fsFileFlush(&file->fd);
   if(R_SUCCEEDED(rc))
     return 0;
 
@@ -13,27 +13,61 @@
 #include "runtime/util/utf.h"
 #include "services/fs.h"
 #include "runtime/env.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
+#include "kernel/thread.h"
+#include "result.h"
 #include "nro.h"
 
+typedef struct
+{
+    u64 tag;   // block index within the RomFS image
+    u64 stamp; // LRU stamp, 0 if the slot is empty
+    u64 size;  // number of valid bytes in the slot
+} romfs_cache_block;
+
+typedef struct
+{
+    u64 hash;   // hash of the absolute path, 0 if the slot is empty
+    u32 offset; // offset of the entry within the directory or file table
+    u32 is_dir;
+} romfs_index_entry;
+
+typedef enum
+{
+    RomfsSource_FsFile,
+    RomfsSource_FsStorage,
+    RomfsSource_Memory,
+} RomfsSource;
+
 typedef struct romfs_mount
 {
-    bool               fd_type;
+    RomfsSource        fd_type;
     FsFile             fd;
     FsStorage          fd_storage;
     time_t             mtime;
     u64                offset;
+    const u8           *mem_data;
+    u64                mem_offset, mem_size;
+    bool               mem_owned;
     romfs_header       header;
     romfs_dir          *cwd;
     u32                *dirHashTable, *fileHashTable;
     void               *dirTable, *fileTable;
+    Mutex              cache_mutex;
+    u8                 *cache_data;
+    romfs_cache_block  *cache_blocks;
+    u32                cache_block_size, cache_num_blocks, cache_max_readahead;
+    u64                cache_stamp;
+    RomfsCacheStats    cache_stats;
+    romfs_index_entry  *index;
+    u32                index_mask;
     struct romfs_mount *next;
 } romfs_mount;
 
 extern int __system_argc;
 extern char** __system_argv;
 
-static char __component[PATH_MAX+1];
-
 #define romFS_root(m)   ((romfs_dir*)(m)->dirTable)
 #define romFS_dir(m,x)  ((romfs_dir*) ((u8*)(m)->dirTable  + (x)))
 #define romFS_file(m,x) ((romfs_file*)((u8*)(m)->fileTable + (x)))
@@ -43,10 +77,25 @@ static char __component[PATH_MAX+1];
 
 static ssize_t _romfs_read(romfs_mount *mount, u64 offset, void* buffer, u64 size)
 {
+    if(mount->mem_data && offset >= mount->mem_offset)
+    {
+        u64 memOff = offset - mount->mem_offset;
+        u64 avail  = memOff < mount->mem_size ? mount->mem_size - memOff : 0;
+
+        // a memory image is read like a file (short reads at the end), resident data only serves what it covers
+        if(mount->fd_type == RomfsSource_Memory && size > avail)
+            size = avail;
+        if(size <= avail)
+        {
+            memcpy(buffer, mount->mem_data + memOff, size);
+            return size;
+        }
+    }
+
     u64 pos = mount->offset + offset;
     size_t read = 0;
     Result rc = 0;
-    if(!mount->fd_type)
+    if(mount->fd_type == RomfsSource_FsFile)
     {
         rc = fsFileRead(&mount->fd, pos, buffer, size, &read);
     }
@@ -83,6 +132,8 @@ typedef struct
     romfs_mount *mount;
     romfs_file  *file;
     u64         offset, pos;
+    u64         ra_next;   // position following the previous read
+    u32         ra_blocks; // current read-ahead window, in cache blocks
 } romfs_fileobj;
 
 typedef struct
@@ -117,6 +168,10 @@ static devoptab_t romFS_devoptab =
 
 static Result romfsMountCommon(romfs_mount *mount);
 static void romfsInitMtime(romfs_mount *mount);
+static void romfs_batch_stop(void);
+static void romfs_batch_cancel(romfs_mount *mount);
+static __thread bool romfs_batch_is_worker; // set on the I/O thread
+static int romfs_find_file(romfs_mount *mount, const char *path, romfs_file **ppFile);
 
 __attribute__((weak)) const char* __romfs_path = NULL;
 
@@ -150,9 +205,20 @@ static romfs_mount* romfs_alloc(void)
     return mount;
 }
 
+static void romfs_close_fd(romfs_mount *mount)
+{
+    if(mount->fd_type == RomfsSource_FsFile)fsFileClose(&mount->fd);
+    if(mount->fd_type == RomfsSource_FsStorage)fsStorageClose(&mount->fd_storage);
+}
+
 static void romfs_free(romfs_mount *mount)
 {
     romfs_remove(mount);
+    if(mount->mem_owned)
+        free((void*)mount->mem_data);
+    free(mount->cache_data);
+    free(mount->cache_blocks);
+    free(mount->index);
     free(mount->fileTable);
     free(mount->fileHashTable);
     free(mount->dirTable);
@@ -170,7 +236,7 @@ Result romfsMount(struct romfs_mount **p)
     {
         // RomFS embedded in a NRO
 
-        mount->fd_type = 0;
+        mount->fd_type = RomfsSource_FsFile;
 
         FsFileSystem *sdfs = fsdevGetDefaultFileSystem();
         if(sdfs==NULL)
@@ -179,6 +245,7 @@ Result romfsMount(struct romfs_mount **p)
             return 1;
         }
 
+        char nxlink_path[PATH_MAX+1];
         const char* filename = __romfs_path;
         if (__system_argc > 0 && __system_argv[0])
             filename = __system_argv[0];
@@ -192,10 +259,10 @@ Result romfsMount(struct romfs_mount **p)
             filename += 5;
         else if (strncmp(filename, "nxlink:/", 8) == 0)
         {
-            strncpy(__component, "/switch",     PATH_MAX);
-            strncat(__component, filename+7, PATH_MAX);
-            __component[PATH_MAX] = 0;
-            filename = __component;
+            strncpy(nxlink_path, "/switch",     PATH_MAX);
+            strncat(nxlink_path, filename+7, PATH_MAX);
+            nxlink_path[PATH_MAX] = 0;
+            filename = nxlink_path;
         }
         else
         {
@@ -231,7 +298,7 @@ Result romfsMount(struct romfs_mount **p)
     {
         // Regular RomFS
 
-        mount->fd_type = 1;
+        mount->fd_type = RomfsSource_FsStorage;
 
         Result rc = fsOpenDataStorageByCurrentProcess(&mount->fd_storage);
         if (R_FAILED(rc))
@@ -250,8 +317,7 @@ Result romfsMount(struct romfs_mount **p)
     return ret;
 
 _fail0:
-    if(!mount->fd_type)fsFileClose(&mount->fd);
-    if(mount->fd_type)fsStorageClose(&mount->fd_storage);
+    romfs_close_fd(mount);
     romfs_free(mount);
     return 10;
 }
@@ -262,7 +328,7 @@ Result romfsMountFromFile(FsFile file, u64 offset, struct romfs_mount **p)
     if(mount == NULL)
         return 99;
 
-    mount->fd_type = 0;
+    mount->fd_type = RomfsSource_FsFile;
     mount->fd     = file;
     mount->offset = offset;
 
@@ -279,7 +345,7 @@ Result romfsMountFromStorage(FsStorage storage, u64 offset, struct romfs_mount *
     if(mount == NULL)
         return 99;
 
-    mount->fd_type = 1;
+    mount->fd_type = RomfsSource_FsStorage;
     mount->fd_storage = storage;
     mount->offset = offset;
 
@@ -290,6 +356,27 @@ Result romfsMountFromStorage(FsStorage storage, u64 offset, struct romfs_mount *
     return ret;
 }
 
+Result romfsMountFromMemory(const void *image, size_t size, struct romfs_mount **p)
+{
+    if(image == NULL || size < sizeof(romfs_header))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    romfs_mount *mount = romfs_alloc();
+    if(mount == NULL)
+        return 99;
+
+    mount->fd_type  = RomfsSource_Memory;
+    mount->mem_data = (const u8*)image;
+    mount->mem_size = size;
+    romfsInitMtime(mount);
+
+    Result ret = romfsMountCommon(mount);
+    if(R_SUCCEEDED(ret) && p)
+        *p = mount;
+
+    return ret;
+}
+
 Result romfsMountCommon(romfs_mount *mount)
 {
     if (_romfs_read(mount, 0, &mount->header, sizeof(mount->header)) != sizeof(mount->header))
@@ -328,8 +415,7 @@ Result romfsMountCommon(romfs_mount *mount)
     return 0;
 
 fail:
-    if(!mount->fd_type)fsFileClose(&mount->fd);
-    if(mount->fd_type)fsStorageClose(&mount->fd_storage);
+    romfs_close_fd(mount);
     romfs_free(mount);
     return 10;
 }
@@ -354,35 +440,301 @@ Result romfsBind(struct romfs_mount *mount)
     return 99;
 }
 
+static void romfs_unmount_one(romfs_mount *mount)
+{
+    // no batch may reference the mount once it's freed
+    romfs_batch_cancel(mount);
+    if(romfs_mount_list == mount && mount->next == NULL)
+        romfs_batch_stop();
+
+    romfs_close_fd(mount);
+    romfs_free(mount);
+}
+
 Result romfsUnmount(struct romfs_mount *mount)
 {
+    // unmounting waits for the I/O thread, so it can't be done from a batch callback
+    if(romfs_batch_is_worker)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
     if(mount)
     {
         // unmount specific
-        if(!mount->fd_type)fsFileClose(&mount->fd);
-        if(mount->fd_type)fsStorageClose(&mount->fd_storage);
-        romfs_free(mount);
+        romfs_unmount_one(mount);
     }
     else
     {
         // unmount everything
         while(romfs_mount_list)
-        {
-            if(!romfs_mount_list->fd_type)fsFileClose(&romfs_mount_list->fd);
-            if(romfs_mount_list->fd_type)fsStorageClose(&romfs_mount_list->fd_storage);
-            romfs_free(romfs_mount_list);
-        }
+            romfs_unmount_one(romfs_mount_list);
     }
 
     // if no more mounts, remove device
     if(romfs_mount_list == NULL)
+    {
         RemoveDevice("romfs:");
+        romfs_batch_stop();
+    }
+
+    return 0;
+}
+
+Result romfsSetCacheConfig(struct romfs_mount *mount, u32 block_size, u32 num_blocks, u32 max_readahead)
+{
+    if(mount == NULL)
+        mount = romfs_mount_list;
+    if(mount == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    if(block_size & (block_size - 1))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    u8 *data = NULL;
+    romfs_cache_block *blocks = NULL;
+
+    if(block_size && num_blocks)
+    {
+        if(max_readahead == 0)
+            max_readahead = 1;
+        if(max_readahead > num_blocks)
+            max_readahead = num_blocks;
+
+        data   = (u8*)malloc((size_t)block_size * num_blocks);
+        blocks = (romfs_cache_block*)calloc(num_blocks, sizeof(romfs_cache_block));
+        if(data == NULL || blocks == NULL)
+        {
+            free(data);
+            free(blocks);
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+    }
+    else
+    {
+        block_size = num_blocks = max_readahead = 0;
+    }
+
+    mutexLock(&mount->cache_mutex);
+    free(mount->cache_data);
+    free(mount->cache_blocks);
+    mount->cache_data          = data;
+    mount->cache_blocks        = blocks;
+    mount->cache_block_size    = block_size;
+    mount->cache_num_blocks    = num_blocks;
+    mount->cache_max_readahead = max_readahead;
+    mount->cache_stamp         = 0;
+    mutexUnlock(&mount->cache_mutex);
+
+    return 0;
+}
+
+Result romfsGetCacheStats(struct romfs_mount *mount, RomfsCacheStats *out)
+{
+    if(mount == NULL)
+        mount = romfs_mount_list;
+    if(mount == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    mutexLock(&mount->cache_mutex);
+    *out = mount->cache_stats;
+    mutexUnlock(&mount->cache_mutex);
+
+    return 0;
+}
+
+Result romfsSetResident(struct romfs_mount *mount)
+{
+    if(mount == NULL)
+        mount = romfs_mount_list;
+    if(mount == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    if(mount->mem_data)
+        return 0;
+
+    // the data region ends with the file whose data extends furthest
+    u64 dataSize = 0;
+    for(u64 off = 0; off + sizeof(romfs_file) <= mount->header.fileTableSize;)
+    {
+        romfs_file *file = romFS_file(mount, off);
+        if(file->dataOff + file->dataSize > dataSize)
+            dataSize = file->dataOff + file->dataSize;
+        off += sizeof(romfs_file) + ((file->nameLen + 3) & ~3);
+    }
+
+    u8 *data = (u8*)malloc(dataSize ? dataSize : 1);
+    if(data == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    if(!_romfs_read_chk(mount, mount->header.fileDataOff, data, dataSize))
+    {
+        free(data);
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+
+    mount->mem_offset = mount->header.fileDataOff;
+    mount->mem_size   = dataSize;
+    mount->mem_owned  = true;
+    mount->mem_data   = data;
+
+    return 0;
+}
+
+Result romfsGetFileData(struct romfs_mount *mount, const char *path, const void **data, u64 *size)
+{
+    if(mount == NULL)
+        mount = romfs_mount_list;
+    if(mount == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    if(mount->mem_data == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    romfs_file* file = NULL;
+    if(romfs_find_file(mount, path, &file) != 0)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    u64 offset = mount->header.fileDataOff + file->dataOff;
+    if(offset < mount->mem_offset || offset - mount->mem_offset > mount->mem_size
+        || file->dataSize > mount->mem_size - (offset - mount->mem_offset))
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    *data = mount->mem_data + (offset - mount->mem_offset);
+    *size = file->dataSize;
 
     return 0;
 }
 
 //-----------------------------------------------------------------------------
 
+static romfs_cache_block* romfs_cache_lookup(romfs_mount *mount, u64 tag)
+{
+    for(u32 i = 0; i < mount->cache_num_blocks; i++)
+    {
+        romfs_cache_block *block = &mount->cache_blocks[i];
+        if(block->stamp && block->tag == tag)
+            return block;
+    }
+    return NULL;
+}
+
+// Fetches up to `count` consecutive blocks starting at `tag` with a single read, never reading past `limit`.
+static romfs_cache_block* romfs_cache_fill(romfs_mount *mount, u64 tag, u32 count, u64 limit)
+{
+    u64 bs = mount->cache_block_size;
+
+    // the read-ahead window of a file may predate a smaller cache configuration
+    if(count > mount->cache_num_blocks)
+        count = mount->cache_num_blocks;
+
+    // stop the read-ahead at the first block that is already cached
+    for(u32 i = 1; i < count; i++)
+    {
+        if((tag + i) * bs >= limit || romfs_cache_lookup(mount, tag + i))
+        {
+            count = i;
+            break;
+        }
+    }
+
+    // evict the run of `count` adjacent slots whose most recently used block is the oldest
+    u32 first = 0;
+    u64 firstStamp = UINT64_MAX;
+    for(u32 i = 0; i + count <= mount->cache_num_blocks; i++)
+    {
+        u64 stamp = 0;
+        for(u32 j = 0; j < count; j++)
+            stamp = MAX(stamp, mount->cache_blocks[i + j].stamp);
+
+        if(stamp < firstStamp)
+        {
+            first      = i;
+            firstStamp = stamp;
+        }
+    }
+
+    u64 start = tag * bs;
+    u64 size  = count * bs;
+    if(start + size > limit)
+        size = limit - start;
+
+    for(u32 i = 0; i < count; i++)
+        mount->cache_blocks[first + i].stamp = 0;
+
+    ssize_t got = _romfs_read(mount, start, mount->cache_data + first * bs, size);
+    if(got <= 0)
+        return NULL;
+
+    for(u32 i = 0; i < count && (u64)got > i * bs; i++)
+    {
+        romfs_cache_block *block = &mount->cache_blocks[first + i];
+        block->tag   = tag + i;
+        block->stamp = ++mount->cache_stamp;
+        block->size  = MIN((u64)got - i * bs, bs);
+    }
+
+    mount->cache_stats.misses++;
+    if(count > 1)
+        mount->cache_stats.readahead_blocks += count - 1;
+
+    return &mount->cache_blocks[first];
+}
+
+static ssize_t _romfs_cache_read(romfs_fileobj *file, void* buffer, u64 size)
+{
+    romfs_mount *mount = file->mount;
+    u64 bs    = mount->cache_block_size;
+    u64 pos   = file->offset + file->pos;
+    u64 limit = file->offset + file->file->dataSize;
+
+    if(size >= bs)
+    {
+        mount->cache_stats.bypasses++;
+        return _romfs_read(mount, pos, buffer, size);
+    }
+
+    u8  *dst  = (u8*)buffer;
+    u64 end   = pos + size;
+    while(pos < end)
+    {
+        u64 tag      = pos / bs;
+        u64 blockOff = pos - tag * bs;
+        u64 chunk    = MIN(end - pos, bs - blockOff);
+
+        romfs_cache_block *block = romfs_cache_lookup(mount, tag);
+        if(block && block->size < blockOff + chunk)
+        {
+            // cached by a read that ended early, fetch the block again
+            block->stamp = 0;
+            block = NULL;
+        }
+
+        if(block)
+        {
+            block->stamp = ++mount->cache_stamp;
+            mount->cache_stats.hits++;
+        }
+        else
+        {
+            block = romfs_cache_fill(mount, tag, file->ra_blocks, limit);
+            if(block == NULL || block->size < blockOff + chunk)
+                return -1;
+
+            if(file->ra_blocks > mount->cache_max_readahead)
+                file->ra_blocks = mount->cache_max_readahead;
+            else if(file->ra_blocks < mount->cache_max_readahead)
+                file->ra_blocks = MIN(file->ra_blocks * 2, mount->cache_max_readahead);
+        }
+
+        memcpy(dst, mount->cache_data + (block - mount->cache_blocks) * bs + blockOff, chunk);
+        dst += chunk;
+        pos += chunk;
+    }
+
+    return size;
+}
+
+//-----------------------------------------------------------------------------
+
 static u32 calcHash(u32 parent, const uint8_t* name, u32 namelen, u32 total)
 {
     u32 hash = parent ^ 123456789;
@@ -431,7 +783,7 @@ static romfs_file* searchForFile(romfs_mount *mount, romfs_dir* parent, const ui
 
 static int navigateToDir(romfs_mount *mount, romfs_dir** ppDir, const char** pPath, bool isDir)
 {
-    char* colonPos = strchr(*pPath, ':');
+    const char* colonPos = strchr(*pPath, ':');
     if (colonPos) *pPath = colonPos+1;
     if (!**pPath)
         return EILSEQ;
@@ -443,40 +795,40 @@ static int navigateToDir(romfs_mount *mount, romfs_dir** ppDir, const char** pPa
         (*pPath)++;
     }
 
+    // components are matched in place, so concurrent lookups don't share any state
     while (**pPath)
     {
-        char* slashPos = strchr(*pPath, '/');
-        char* component = __component;
+        const char* component = *pPath;
+        const char* slashPos = strchr(component, '/');
+        u32 len;
 
         if (slashPos)
         {
-            u32 len = slashPos - *pPath;
+            len = slashPos - component;
             if (!len)
                 return EILSEQ;
             if (len > PATH_MAX)
                 return ENAMETOOLONG;
 
-            memcpy(component, *pPath, len);
-            component[len] = 0;
             *pPath = slashPos+1;
         } else if (isDir)
         {
-            component = (char*)*pPath;
-            *pPath += strlen(component);
+            len = strlen(component);
+            *pPath += len;
         } else
             return 0;
 
         if (component[0]=='.')
         {
-            if (!component[1]) continue;
-            if (component[1]=='.' && !component[2])
+            if (len == 1) continue;
+            if (len == 2 && component[1]=='.')
             {
                 *ppDir = romFS_dir(mount, (*ppDir)->parent);
                 continue;
             }
         }
 
-        *ppDir = searchForDir(mount, *ppDir, (uint8_t*)component, strlen(component));
+        *ppDir = searchForDir(mount, *ppDir, (const uint8_t*)component, len);
         if (!*ppDir)
             return EEXIST;
     }
@@ -487,6 +839,471 @@ static int navigateToDir(romfs_mount *mount, romfs_dir** ppDir, const char** pPa
     return 0;
 }
 
+#define romFS_hash_basis 0xcbf29ce484222325ULL
+#define romFS_hash_prime 0x100000001b3ULL
+
+// FNV-1a over "/" followed by the component, so that hashes chain along the path
+static u64 romfs_hash_component(u64 hash, const uint8_t* name, u32 namelen)
+{
+    hash = (hash ^ '/') * romFS_hash_prime;
+    for (u32 i = 0; i < namelen; i ++)
+        hash = (hash ^ name[i]) * romFS_hash_prime;
+    return hash ? hash : 1;
+}
+
+static void romfs_index_insert(romfs_mount *mount, u64 hash, u32 offset, bool is_dir)
+{
+    u32 slot = hash & mount->index_mask;
+    while (mount->index[slot].hash)
+        slot = (slot + 1) & mount->index_mask;
+
+    mount->index[slot].hash   = hash;
+    mount->index[slot].offset = offset;
+    mount->index[slot].is_dir = is_dir;
+}
+
+static void romfs_index_dir(romfs_mount *mount, romfs_dir *dir, u64 hash)
+{
+    for (u32 off = dir->childFile; off != romFS_none;)
+    {
+        romfs_file *file = romFS_file(mount, off);
+        romfs_index_insert(mount, romfs_hash_component(hash, file->name, file->nameLen), off, false);
+        off = file->sibling;
+    }
+
+    for (u32 off = dir->childDir; off != romFS_none;)
+    {
+        romfs_dir *child = romFS_dir(mount, off);
+        u64 childHash = romfs_hash_component(hash, child->name, child->nameLen);
+        romfs_index_insert(mount, childHash, off, true);
+        romfs_index_dir(mount, child, childHash);
+        off = child->sibling;
+    }
+}
+
+// Checks an index hit against the path by walking up the parents, from the last component to the first.
+static bool romfs_index_verify(romfs_mount *mount, const romfs_index_entry *entry, const char *path, const char *end)
+{
+    const uint8_t* name;
+    u32 nameLen, parent;
+
+    if (entry->is_dir)
+    {
+        romfs_dir *dir = romFS_dir(mount, entry->offset);
+        name = dir->name; nameLen = dir->nameLen; parent = dir->parent;
+    }
+    else
+    {
+        romfs_file *file = romFS_file(mount, entry->offset);
+        name = file->name; nameLen = file->nameLen; parent = file->parent;
+    }
+
+    for (;;)
+    {
+        if ((u64)(end - path) < nameLen)
+            return false;
+        end -= nameLen;
+        if (memcmp(end, name, nameLen) != 0)
+            return false;
+        if (parent == 0)
+            return end == path;
+        if (end == path || end[-1] != '/')
+            return false;
+        end--;
+
+        romfs_dir *dir = romFS_dir(mount, parent);
+        name = dir->name; nameLen = dir->nameLen; parent = dir->parent;
+    }
+}
+
+// Looks up a normalized path in the full-path index. Returns NULL when there is no index, the path
+// is not in normalized form (relative to another directory, empty, "." or ".." components) or not found.
+static romfs_index_entry* romfs_index_lookup(romfs_mount *mount, const char *path)
+{
+    if (!mount->index)
+        return NULL;
+
+    const char* colonPos = strchr(path, ':');
+    if (colonPos) path = colonPos+1;
+
+    if (*path == '/')
+        path++;
+    else if (mount->cwd != romFS_root(mount))
+        return NULL;
+
+    if (!*path)
+        return NULL;
+
+    const char* component = path;
+    u64 hash = romFS_hash_basis;
+    for (;;)
+    {
+        const char* slashPos = strchr(component, '/');
+        u32 len = slashPos ? (u32)(slashPos - component) : strlen(component);
+        if (!len || (component[0] == '.' && (len == 1 || (len == 2 && component[1] == '.'))))
+            return NULL;
+
+        hash = romfs_hash_component(hash, (const uint8_t*)component, len);
+        if (!slashPos)
+        {
+            component += len;
+            break;
+        }
+        component = slashPos+1;
+    }
+
+    for (u32 slot = hash & mount->index_mask; mount->index[slot].hash; slot = (slot + 1) & mount->index_mask)
+    {
+        romfs_index_entry *entry = &mount->index[slot];
+        if (entry->hash == hash && romfs_index_verify(mount, entry, path, component))
+            return entry;
+    }
+
+    return NULL;
+}
+
+static int romfs_find_file(romfs_mount *mount, const char *path, romfs_file **ppFile)
+{
+    romfs_index_entry* entry = romfs_index_lookup(mount, path);
+    if (entry && !entry->is_dir)
+    {
+        *ppFile = romFS_file(mount, entry->offset);
+        return 0;
+    }
+
+    romfs_dir* curDir = NULL;
+    int err = navigateToDir(mount, &curDir, &path, false);
+    if (err != 0)
+        return err;
+
+    *ppFile = searchForFile(mount, curDir, (uint8_t*)path, strlen(path));
+    return *ppFile ? 0 : ENOENT;
+}
+
+Result romfsCreatePathIndex(struct romfs_mount *mount)
+{
+    if(mount == NULL)
+        mount = romfs_mount_list;
+    if(mount == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    if(mount->index)
+        return 0;
+
+    // count all entries by walking both tables
+    u64 count = 0;
+    for(u64 off = 0; off + sizeof(romfs_dir) <= mount->header.dirTableSize; count++)
+        off += sizeof(romfs_dir) + ((romFS_dir(mount, off)->nameLen + 3) & ~3);
+    for(u64 off = 0; off + sizeof(romfs_file) <= mount->header.fileTableSize; count++)
+        off += sizeof(romfs_file) + ((romFS_file(mount, off)->nameLen + 3) & ~3);
+
+    // keep the load factor at or below 50%
+    u64 capacity = 16;
+    while(capacity < count * 2)
+        capacity <<= 1;
+    if(capacity > ((u64)1 << 32))
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    mount->index = (romfs_index_entry*)calloc(capacity, sizeof(romfs_index_entry));
+    if(mount->index == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    mount->index_mask = capacity - 1;
+    romfs_index_dir(mount, romFS_root(mount), romFS_hash_basis);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+// Requests closer than this are merged, reading the gap between them rather than issuing another read.
+#define ROMFS_BATCH_MAX_GAP  0x1000
+// Upper bound for a merged read, which goes through a staging buffer of this size.
+#define ROMFS_BATCH_MAX_SPAN 0x40000
+
+typedef struct
+{
+    u64              pos; // offset of the data within the RomFS image
+    u64              size;
+    RomfsReadRequest *req;
+} romfs_batch_span;
+
+static Mutex            romfs_batch_mutex;
+static CondVar          romfs_batch_cond;
+static Thread           romfs_batch_thread;
+static bool             romfs_batch_running, romfs_batch_exiting;
+static RomfsReadBatch   *romfs_batch_head, *romfs_batch_tail;
+static romfs_mount      *romfs_batch_current_mount; // mount of the batch being executed by the I/O thread
+
+static int romfs_batch_span_cmp(const void *a, const void *b)
+{
+    const romfs_batch_span *x = (const romfs_batch_span*)a;
+    const romfs_batch_span *y = (const romfs_batch_span*)b;
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+static Result romfs_batch_execute(romfs_mount *mount, RomfsReadRequest *requests, size_t count)
+{
+    Result rc = 0;
+    size_t numSpans = 0;
+    romfs_batch_span *spans = (romfs_batch_span*)malloc(count * sizeof(romfs_batch_span));
+    if(spans == NULL && count)
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        RomfsReadRequest *req = &requests[i];
+        romfs_file *file = NULL;
+
+        req->result = -1;
+        if(romfs_find_file(mount, req->path, &file) != 0)
+        {
+            if(R_SUCCEEDED(rc))
+                rc = MAKERESULT(Module_Libnx, LibnxError_NotFound);
+            continue;
+        }
+
+        if(req->offset >= file->dataSize || req->size == 0)
+        {
+            req->result = 0;
+            continue;
+        }
+
+        spans[numSpans].pos  = mount->header.fileDataOff + file->dataOff + req->offset;
+        spans[numSpans].size = MIN(req->size, file->dataSize - req->offset);
+        spans[numSpans].req  = req;
+        numSpans++;
+    }
+
+    qsort(spans, numSpans, sizeof(romfs_batch_span), romfs_batch_span_cmp);
+
+    u8 *staging = NULL;
+    for(size_t i = 0; i < numSpans;)
+    {
+        u64 start = spans[i].pos;
+        u64 end   = start + spans[i].size;
+        size_t j  = i + 1;
+
+        // resident data is copied directly, there is nothing to gain from merging
+        if(!mount->mem_data)
+        {
+            for(; j < numSpans && spans[j].pos <= end + ROMFS_BATCH_MAX_GAP; j++)
+            {
+                u64 newEnd = MAX(end, spans[j].pos + spans[j].size);
+                if(newEnd - start > ROMFS_BATCH_MAX_SPAN)
+                    break;
+                end = newEnd;
+            }
+        }
+
+        if(j > i + 1 && staging == NULL)
+            staging = (u8*)malloc(ROMFS_BATCH_MAX_SPAN);
+
+        if(j == i + 1 || staging == NULL)
+        {
+            for(size_t k = i; k < j; k++)
+                spans[k].req->result = _romfs_read(mount, spans[k].pos, spans[k].req->buffer, spans[k].size);
+        }
+        else
+        {
+            ssize_t got = _romfs_read(mount, start, staging, end - start);
+            for(size_t k = i; k < j; k++)
+            {
+                u64 off = spans[k].pos - start;
+                if(got >= 0 && (u64)got >= off + spans[k].size)
+                {
+                    memcpy(spans[k].req->buffer, staging + off, spans[k].size);
+                    spans[k].req->result = spans[k].size;
+                }
+            }
+        }
+
+        i = j;
+    }
+
+    free(staging);
+    free(spans);
+
+    if(R_SUCCEEDED(rc))
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            if(requests[i].result < 0)
+            {
+                rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+                break;
+            }
+        }
+    }
+
+    return rc;
+}
+
+Result romfsReadBatch(struct romfs_mount *mount, RomfsReadRequest *requests, size_t count)
+{
+    if(mount == NULL)
+        mount = romfs_mount_list;
+    if(mount == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    return romfs_batch_execute(mount, requests, count);
+}
+
+static void romfs_batch_worker(void *arg)
+{
+    romfs_batch_is_worker = true;
+
+    mutexLock(&romfs_batch_mutex);
+    for(;;)
+    {
+        while(romfs_batch_head == NULL && !romfs_batch_exiting)
+            condvarWait(&romfs_batch_cond);
+
+        RomfsReadBatch *batch = romfs_batch_head;
+        if(batch == NULL)
+            break;
+
+        romfs_batch_head = batch->next;
+        if(romfs_batch_head == NULL)
+            romfs_batch_tail = NULL;
+        romfs_batch_current_mount = batch->mount;
+        mutexUnlock(&romfs_batch_mutex);
+
+        batch->rc = romfs_batch_execute(batch->mount, batch->requests, batch->count);
+        if(batch->callback)
+            batch->callback(batch->requests, batch->count, batch->userdata);
+
+        mutexLock(&romfs_batch_mutex);
+        romfs_batch_current_mount = NULL;
+        condvarWakeAll(&romfs_batch_cond); // for romfs_batch_cancel
+
+        // the batch may be freed as soon as this is signalled
+        semaphoreSignal(&batch->done);
+    }
+    mutexUnlock(&romfs_batch_mutex);
+}
+
+Result romfsReadBatchAsync(struct romfs_mount *mount, RomfsReadRequest *requests, size_t count, RomfsReadBatchCallback callback, void *userdata, RomfsReadBatch *batch)
+{
+    if(mount == NULL)
+        mount = romfs_mount_list;
+    if(mount == NULL)
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    batch->mount    = mount;
+    batch->requests = requests;
+    batch->count    = count;
+    batch->callback = callback;
+    batch->userdata = userdata;
+    batch->rc       = 0;
+    batch->next     = NULL;
+    semaphoreInit(&batch->done, 0);
+
+    Result rc = 0;
+    mutexLock(&romfs_batch_mutex);
+    if(!romfs_batch_running)
+    {
+        condvarInit(&romfs_batch_cond, &romfs_batch_mutex);
+        romfs_batch_exiting = false;
+
+        rc = threadCreate(&romfs_batch_thread, romfs_batch_worker, NULL, 0x4000, 0x2C, -2);
+        if(R_SUCCEEDED(rc))
+        {
+            rc = threadStart(&romfs_batch_thread);
+            if(R_FAILED(rc))
+                threadClose(&romfs_batch_thread);
+        }
+        romfs_batch_running = R_SUCCEEDED(rc);
+    }
+
+    if(R_SUCCEEDED(rc))
+    {
+        if(romfs_batch_tail)
+            romfs_batch_tail->next = batch;
+        else
+            romfs_batch_head = batch;
+        romfs_batch_tail = batch;
+        condvarWakeAll(&romfs_batch_cond); // romfs_batch_cancel may be waiting on it too
+    }
+    mutexUnlock(&romfs_batch_mutex);
+
+    return rc;
+}
+
+Result romfsReadBatchWait(RomfsReadBatch *batch)
+{
+    semaphoreWait(&batch->done);
+    return batch->rc;
+}
+
+static void romfs_batch_stop(void)
+{
+    mutexLock(&romfs_batch_mutex);
+    if(!romfs_batch_running)
+    {
+        mutexUnlock(&romfs_batch_mutex);
+        return;
+    }
+    romfs_batch_exiting = true;
+    condvarWakeAll(&romfs_batch_cond);
+    mutexUnlock(&romfs_batch_mutex);
+
+    threadWaitForExit(&romfs_batch_thread);
+    threadClose(&romfs_batch_thread);
+
+    mutexLock(&romfs_batch_mutex);
+    romfs_batch_running = false;
+    mutexUnlock(&romfs_batch_mutex);
+}
+
+// Fails the queued batches of a mount and waits for the one being executed, if any.
+static void romfs_batch_cancel(romfs_mount *mount)
+{
+    RomfsReadBatch *cancelled = NULL, **cancelled_tail = &cancelled;
+
+    mutexLock(&romfs_batch_mutex);
+    if(!romfs_batch_running)
+    {
+        mutexUnlock(&romfs_batch_mutex);
+        return;
+    }
+
+    romfs_batch_tail = NULL;
+    for(RomfsReadBatch **it = &romfs_batch_head; *it;)
+    {
+        RomfsReadBatch *batch = *it;
+        if(batch->mount == mount)
+        {
+            *it = batch->next;
+            batch->next = NULL;
+            *cancelled_tail = batch;
+            cancelled_tail = &batch->next;
+        }
+        else
+        {
+            romfs_batch_tail = batch;
+            it = &batch->next;
+        }
+    }
+
+    while(romfs_batch_current_mount == mount)
+        condvarWait(&romfs_batch_cond);
+    mutexUnlock(&romfs_batch_mutex);
+
+    while(cancelled)
+    {
+        RomfsReadBatch *batch = cancelled;
+        cancelled = batch->next;
+
+        batch->rc = MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+        if(batch->callback)
+            batch->callback(batch->requests, batch->count, batch->userdata);
+        semaphoreSignal(&batch->done);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
 static ino_t dir_inode(romfs_mount *mount, romfs_dir *dir)
 {
     return (uint32_t*)dir - (uint32_t*)mount->dirTable;
@@ -539,12 +1356,11 @@ int romfs_open(struct _reent *r, void *fileStruct, const char *path, int flags,
         return -1;
     }
 
-    romfs_dir* curDir = NULL;
-    r->_errno = navigateToDir(fileobj->mount, &curDir, &path, false);
-    if (r->_errno != 0)
+    romfs_file* file = NULL;
+    r->_errno = romfs_find_file(fileobj->mount, path, &file);
+    if (r->_errno != 0 && r->_errno != ENOENT)
         return -1;
 
-    romfs_file* file = searchForFile(fileobj->mount, curDir, (uint8_t*)path, strlen(path));
     if (!file)
     {
         if(flags & O_CREAT)
@@ -559,9 +1375,11 @@ int romfs_open(struct _reent *r, void *fileStruct, const char *path, int flags,
         return -1;
     }
 
-    fileobj->file   = file;
-    fileobj->offset = fileobj->mount->header.fileDataOff + file->dataOff;
-    fileobj->pos    = 0;
+    fileobj->file      = file;
+    fileobj->offset    = fileobj->mount->header.fileDataOff + file->dataOff;
+    fileobj->pos       = 0;
+    fileobj->ra_next   = 0;
+    fileobj->ra_blocks = 1;
 
     return 0;
 }
@@ -585,10 +1403,25 @@ ssize_t romfs_read(struct _reent *r, void *fd, char *ptr, size_t len)
         endPos = file->file->dataSize;
     len = endPos - file->pos;
 
-    ssize_t adv = _romfs_read(file->mount, file->offset + file->pos, ptr, len);
+    ssize_t adv;
+    romfs_mount *mount = file->mount;
+    if(mount->cache_data && !mount->mem_data)
+    {
+        /* restart read-ahead detection on non-sequential access */
+        if(file->pos != file->ra_next)
+            file->ra_blocks = 1;
+
+        mutexLock(&mount->cache_mutex);
+        adv = _romfs_cache_read(file, ptr, len);
+        mutexUnlock(&mount->cache_mutex);
+    }
+    else
+        adv = _romfs_read(mount, file->offset + file->pos, ptr, len);
+
     if(adv >= 0)
     {
-        file->pos += adv;
+        file->pos    += adv;
+        file->ra_next = file->pos;
         return adv;
     }
 
@@ -657,12 +1490,29 @@ int romfs_fstat(struct _reent *r, void *fd, struct stat *st)
 int romfs_stat(struct _reent *r, const char *path, struct stat *st)
 {
     romfs_mount* mount = romfs_mount_list;
-    romfs_dir* curDir = NULL;
-    r->_errno = navigateToDir(mount, &curDir, &path, false);
-    if(r->_errno != 0)
-        return -1;
+    romfs_dir* dir = NULL;
+    romfs_file* file = NULL;
+
+    romfs_index_entry* entry = romfs_index_lookup(mount, path);
+    if(entry)
+    {
+        if(entry->is_dir)
+            dir = romFS_dir(mount, entry->offset);
+        else
+            file = romFS_file(mount, entry->offset);
+    }
+    else
+    {
+        romfs_dir* curDir = NULL;
+        r->_errno = navigateToDir(mount, &curDir, &path, false);
+        if(r->_errno != 0)
+            return -1;
+
+        dir = searchForDir(mount, curDir, (uint8_t*)path, strlen(path));
+        if(!dir)
+            file = searchForFile(mount, curDir, (uint8_t*)path, strlen(path));
+    }
 
-    romfs_dir* dir = searchForDir(mount, curDir, (uint8_t*)path, strlen(path));
     if(dir)
     {
         memset(st, 0, sizeof(*st));
@@ -677,7 +1527,6 @@ int romfs_stat(struct _reent *r, const char *path, struct stat *st)
         return 0;
     }
 
-    romfs_file* file = searchForFile(mount, curDir, (uint8_t*)path, strlen(path));
     if(file)
     {
         memset(st, 0, sizeof(*st));
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
 #include <malloc.h>
 #include <sys/iosupport.h>
 
@@ -22,12 +23,19 @@
 #include "services/bsd.h"
 #include "services/sfdnsres.h"
 #include "services/nifm.h"
+#include "kernel/svc.h"
+#include "kernel/thread.h"
+#include "kernel/semaphore.h"
+#include "kernel/mutex.h"
+#include "kernel/condvar.h"
 #include "result.h"
 
 int _convert_errno(int bsdErrno);
 
 __thread int h_errno;
 
+static int g_socketDevice = -1;
+
 static SfdnsresConfig g_sfdnsresConfig;
 static __thread Result g_sfdnsresResult;
 
@@ -131,6 +139,7 @@ Result socketInitialize(const SocketInitConfig *config) {
         return MAKERESULT(Module_Libnx, LibnxError_TooManyDevOpTabs);
     }
     else {
+        g_socketDevice = dev;
         g_bsdResult = 0;
         g_bsdErrno = 0;
 
@@ -141,7 +150,12 @@ Result socketInitialize(const SocketInitConfig *config) {
     return ret;
 }
 
+static void _socketDnsWorkerExit(void);
+
 void socketExit(void) {
+    _socketDnsWorkerExit();
+    socketClearDnsCache();
+    g_socketDevice = -1;
     RemoveDevice("soc:");
     bsdExit();
 }
@@ -162,7 +176,7 @@ static int _socketGetFd(int fd) {
         errno = EBADF;
         return -1;
     }
-    if(strcmp(devoptab_list[handle->device]->name, "soc") != 0) {
+    if(handle->device != g_socketDevice) {
         errno = ENOTSOCK;
         return -1;
     }
@@ -236,6 +250,9 @@ static ssize_t _socketRead(struct _reent *r, void *fdptr, char *buf, size_t coun
     return ret;
 }
 
+// Number of fds which poll/select translate on the stack, instead of allocating.
+#define SOCKET_POLL_STACK_FDS 32
+
 /*
     It is way too complicated and inefficient to use devoptab with bsdSelect.
     We're therefore implementing select with poll.
@@ -243,7 +260,8 @@ static ssize_t _socketRead(struct _reent *r, void *fdptr, char *buf, size_t coun
     Code copied from libctru.
 */
 int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
-    struct pollfd *pollinfo;
+    struct pollfd stackfds[SOCKET_POLL_STACK_FDS];
+    struct pollfd *pollinfo = stackfds;
     nfds_t numfds = 0;
     size_t i, j;
     int rc, found;
@@ -260,17 +278,20 @@ int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struc
             ++numfds;
     }
 
-    pollinfo = (struct pollfd*)malloc(numfds * sizeof(struct pollfd));
-    if(pollinfo == NULL) {
-        errno = ENOMEM;
-        return -1;
+    if(numfds > SOCKET_POLL_STACK_FDS) {
+        pollinfo = (struct pollfd*)malloc(numfds * sizeof(struct pollfd));
+        if(pollinfo == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
     }
 
+    // The fds are translated here and polled directly, rather than going through poll().
     for(i = 0, j = 0; i < nfds; ++i) {
         if((readfds && FD_ISSET(i, readfds))
         || (writefds && FD_ISSET(i, writefds))
         || (exceptfds && FD_ISSET(i, exceptfds))) {
-            pollinfo[j].fd      = i;
+            pollinfo[j].fd      = _socketGetFd(i);
             pollinfo[j].events  = 0;
             pollinfo[j].revents = 0;
 
@@ -279,17 +300,24 @@ int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struc
             if(writefds && FD_ISSET(i, writefds))
                 pollinfo[j].events |= POLLOUT;
 
+            if(pollinfo[j].fd == -1) {
+                if(pollinfo != stackfds)
+                    free(pollinfo);
+                return -1;
+            }
+
             ++j;
         }
     }
 
     if(timeout)
-        rc = poll(pollinfo, numfds, timeout->tv_sec*1000 + timeout->tv_usec/1000);
+        rc = _socketParseBsdResult(NULL, bsdPoll(pollinfo, numfds, timeout->tv_sec*1000 + timeout->tv_usec/1000));
     else
-        rc = poll(pollinfo, numfds, -1);
+        rc = _socketParseBsdResult(NULL, bsdPoll(pollinfo, numfds, -1));
 
     if(rc < 0) {
-        free(pollinfo);
+        if(pollinfo != stackfds)
+            free(pollinfo);
         return rc;
     }
 
@@ -327,14 +355,16 @@ int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struc
         }
     }
 
-    free(pollinfo);
+    if(pollinfo != stackfds)
+        free(pollinfo);
 
     return rc;
 }
 
 // This is much saner than select.
 int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
-    struct pollfd *fds2;
+    struct pollfd stackfds[SOCKET_POLL_STACK_FDS];
+    struct pollfd *fds2 = stackfds;
     int ret = 0;
 
     if(fds == NULL) {
@@ -342,10 +372,12 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
         return -1;
     }
 
-    fds2 = (struct pollfd *)malloc(nfds * sizeof(struct pollfd));
-    if(fds2 == NULL) {
-        errno = ENOMEM;
-        return -1;
+    if(nfds > SOCKET_POLL_STACK_FDS) {
+        fds2 = (struct pollfd *)malloc(nfds * sizeof(struct pollfd));
+        if(fds2 == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
     }
 
     for(nfds_t i = 0; i < nfds; i++) {
@@ -367,10 +399,287 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
         }
     }
 
-    free(fds2);
+    if(fds2 != stackfds)
+        free(fds2);
     return ret;
 }
 
+void socketPollSetInit(SocketPollSet *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+void socketPollSetClose(SocketPollSet *set) {
+    free(set->fds);
+    free(set->user_fds);
+    memset(set, 0, sizeof(*set));
+}
+
+static int _socketPollSetFind(const SocketPollSet *set, int fd) {
+    for(u32 i = 0; i < set->count; i++) {
+        if(set->user_fds[i] == fd)
+            return i;
+    }
+    return -1;
+}
+
+int socketPollSetAdd(SocketPollSet *set, int fd, short events) {
+    int sockfd;
+
+    if(_socketPollSetFind(set, fd) != -1) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    sockfd = _socketGetFd(fd);
+    if(sockfd == -1)
+        return -1;
+
+    if(set->count == set->capacity) {
+        u32 capacity = set->capacity ? set->capacity * 2 : 8;
+        struct pollfd *fds = (struct pollfd *)realloc(set->fds, capacity * sizeof(struct pollfd));
+        if(fds == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        set->fds = fds;
+
+        int *user_fds = (int *)realloc(set->user_fds, capacity * sizeof(int));
+        if(user_fds == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        set->user_fds = user_fds;
+        set->capacity = capacity;
+    }
+
+    set->fds[set->count].fd = sockfd;
+    set->fds[set->count].events = events;
+    set->fds[set->count].revents = 0;
+    set->user_fds[set->count] = fd;
+    set->count++;
+    return 0;
+}
+
+int socketPollSetModify(SocketPollSet *set, int fd, short events) {
+    int i = _socketPollSetFind(set, fd);
+    if(i == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    set->fds[i].events = events;
+    return 0;
+}
+
+int socketPollSetRemove(SocketPollSet *set, int fd) {
+    int i = _socketPollSetFind(set, fd);
+    if(i == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    set->count--;
+    set->fds[i] = set->fds[set->count];
+    set->user_fds[i] = set->user_fds[set->count];
+    return 0;
+}
+
+int socketPollSetWait(SocketPollSet *set, struct pollfd *events, int maxevents, int timeout) {
+    int ret, n = 0;
+
+    if(events == NULL || maxevents <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The set already holds translated fds, so it is passed to bsdPoll as-is.
+    ret = _socketParseBsdResult(NULL, bsdPoll(set->fds, set->count, timeout));
+    if(ret <= 0)
+        return ret;
+
+    for(u32 i = 0; i < set->count && n < maxevents; i++) {
+        if(set->fds[i].revents == 0)
+            continue;
+
+        events[n].fd = set->user_fds[i];
+        events[n].events = set->fds[i].events;
+        events[n].revents = set->fds[i].revents;
+        n++;
+    }
+
+    return n;
+}
+
+int socketBufferCreate(SocketBuffer *buf, size_t size) {
+    size = (size + 0xFFF) & ~0xFFF;
+
+    buf->data = memalign(0x1000, size);
+    if(buf->data == NULL) {
+        buf->size = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    buf->size = size;
+    return 0;
+}
+
+void socketBufferClose(SocketBuffer *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->size = 0;
+}
+
+ssize_t socketSendBuffer(int sockfd, const SocketBuffer *buf, size_t offset, size_t len, int flags) {
+    if(buf == NULL || offset > buf->size || len > buf->size - offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
+
+    return _socketParseBsdResult(NULL, (int)bsdSendMapped(sockfd, (const u8 *)buf->data + offset, len, flags));
+}
+
+ssize_t socketRecvBuffer(int sockfd, SocketBuffer *buf, size_t offset, size_t len, int flags) {
+    if(buf == NULL || offset > buf->size || len > buf->size - offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
+
+    return _socketParseBsdResult(NULL, (int)bsdRecvMapped(sockfd, (u8 *)buf->data + offset, len, flags));
+}
+
+typedef struct {
+    FsFile *file;
+    u64 offset;
+    size_t remaining;
+    size_t chunk_size;
+    u8 *bufs[2];
+    size_t lens[2];
+    Result rc;
+    bool abort;
+    Semaphore filled;
+    Semaphore empty;
+} socket_sendfile_t;
+
+// Reads the file into the two buffers in turn, ahead of the sending thread.
+static void _socketSendFileReader(void *arg) {
+    socket_sendfile_t *sf = (socket_sendfile_t *)arg;
+
+    for(int i = 0; ; i ^= 1) {
+        semaphoreWait(&sf->empty);
+        if(sf->abort)
+            break;
+
+        size_t size = sf->remaining < sf->chunk_size ? sf->remaining : sf->chunk_size;
+        size_t out = 0;
+
+        if(size != 0)
+            sf->rc = fsFileRead(sf->file, sf->offset, sf->bufs[i], size, &out);
+
+        // A zero length tells the sending thread to stop, on EOF or error.
+        sf->lens[i] = R_SUCCEEDED(sf->rc) ? out : 0;
+        sf->offset += sf->lens[i];
+        sf->remaining -= sf->lens[i];
+        semaphoreSignal(&sf->filled);
+
+        if(sf->lens[i] == 0)
+            break;
+    }
+}
+
+ssize_t socketSendFile(int sockfd, FsFile *file, u64 offset, size_t count, size_t chunk_size) {
+    socket_sendfile_t sf;
+    Thread thread;
+    size_t total = 0;
+    ssize_t ret = 0;
+    u8 *mem;
+
+    if(file == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
+
+    if(count == 0)
+        return 0;
+
+    if(chunk_size == 0)
+        chunk_size = 0x20000;
+    chunk_size = (chunk_size + 0xFFF) & ~0xFFF;
+
+    mem = (u8 *)memalign(0x1000, chunk_size * 2);
+    if(mem == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset(&sf, 0, sizeof(sf));
+    sf.file = file;
+    sf.offset = offset;
+    sf.remaining = count;
+    sf.chunk_size = chunk_size;
+    sf.bufs[0] = mem;
+    sf.bufs[1] = mem + chunk_size;
+    semaphoreInit(&sf.filled, 0);
+    semaphoreInit(&sf.empty, 2);
+
+    if(R_FAILED(threadCreate(&thread, _socketSendFileReader, &sf, 0x4000, 0x2C, -2))) {
+        free(mem);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(R_FAILED(threadStart(&thread))) {
+        threadClose(&thread);
+        free(mem);
+        errno = EIO;
+        return -1;
+    }
+
+    // Send each buffer while the reader thread fills the other one.
+    for(int i = 0; total < count; i ^= 1) {
+        semaphoreWait(&sf.filled);
+        if(sf.lens[i] == 0)
+            break;
+
+        for(size_t pos = 0; pos < sf.lens[i]; pos += ret) {
+            ret = _socketParseBsdResult(NULL, (int)bsdSendMapped(sockfd, sf.bufs[i] + pos, sf.lens[i] - pos, 0));
+            if(ret <= 0)
+                break;
+            total += ret;
+        }
+
+        if(ret <= 0)
+            break;
+
+        semaphoreSignal(&sf.empty);
+    }
+
+    sf.abort = true;
+    semaphoreSignal(&sf.empty);
+    threadWaitForExit(&thread);
+    threadClose(&thread);
+    free(mem);
+
+    if(total == 0 && ret != -1 && R_FAILED(sf.rc)) {
+        errno = EIO;
+        ret = -1;
+    }
+
+    return total == 0 && ret == -1 ? -1 : (ssize_t)total;
+}
+
 int sysctl(const int *name, unsigned int namelen, void *oldp, size_t *oldlenp, const void *newp, size_t newlen) {
     return _socketParseBsdResult(NULL, bsdSysctl(name, namelen, oldp, oldlenp, newp, newlen));
 }
@@ -405,7 +714,7 @@ int sysctlnametomib(const char *name, int *mibp, size_t *sizep) {
 int socket(int domain, int type, int protocol) {
     int ret, fd, dev;
 
-    dev = FindDevice("soc:");
+    dev = g_socketDevice;
     if(dev == -1)
         return -1;
 
@@ -678,10 +987,14 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
 
     struct mmsghdr msgvec = {
         .msg_hdr = *msg,
-        .msg_len = 1,
+        .msg_len = 0,
     };
 
-    return recvmmsg(sockfd, &msgvec, 1, flags, NULL);
+    if(recvmmsg(sockfd, &msgvec, 1, flags, NULL) != 1)
+        return -1;
+
+    *msg = msgvec.msg_hdr;
+    return msgvec.msg_len;
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
@@ -692,21 +1005,195 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
 
     struct mmsghdr msgvec = {
         .msg_hdr = *msg,
-        .msg_len = 1,
+        .msg_len = 0,
     };
 
-    return sendmmsg(sockfd, &msgvec, 1, flags);
+    if(sendmmsg(sockfd, &msgvec, 1, flags) != 1)
+        return -1;
+
+    return msgvec.msg_len;
+}
+
+/*
+    bsd:u/s SendMMsg/RecvMMsg use a custom serialization which hasn't been reversed yet,
+    so the batched calls issue one SendTo/RecvFrom per datagram. The fd is only looked up once per batch,
+    and messages with several iovecs are (un)gathered through a single scratch buffer.
+*/
+#define SOCKET_MSG_STACK_BUF_SIZE 0x800
+
+static ssize_t _socketIovecSize(const struct iovec *iov, int iovlen) {
+    size_t size = 0;
+
+    if(iovlen < 0 || (iov == NULL && iovlen != 0))
+        return -1;
+
+    for(int i = 0; i < iovlen; i++) {
+        if(iov[i].iov_len > SSIZE_MAX - size)
+            return -1;
+        size += iov[i].iov_len;
+    }
+
+    return size;
+}
+
+// Returns a buffer of at least size bytes, the heap buffer is reused for the rest of the batch.
+static void *_socketMsgScratch(u8 *stackbuf, u8 **heapbuf, size_t *heapsize, size_t size) {
+    if(size <= SOCKET_MSG_STACK_BUF_SIZE)
+        return stackbuf;
+
+    if(size > *heapsize) {
+        free(*heapbuf);
+        *heapbuf = (u8 *)malloc(size);
+        *heapsize = *heapbuf == NULL ? 0 : size;
+    }
+
+    return *heapbuf;
 }
 
 int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
-    //TODO: do the necessary RE & implement it
-    errno = ENOSYS;
-    return -1;
+    u8 stackbuf[SOCKET_MSG_STACK_BUF_SIZE];
+    u8 *heapbuf = NULL;
+    size_t heapsize = 0;
+    unsigned int i;
+    ssize_t ret = 0;
+
+    if(msgvec == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
+
+    for(i = 0; i < vlen; i++) {
+        struct msghdr *msg = &msgvec[i].msg_hdr;
+        ssize_t len = _socketIovecSize(msg->msg_iov, msg->msg_iovlen);
+        const void *data = NULL;
+
+        if(len == -1) {
+            errno = EINVAL;
+            ret = -1;
+            break;
+        }
+
+        if(msg->msg_iovlen == 1)
+            data = msg->msg_iov[0].iov_base;
+        else if(msg->msg_iovlen > 1) {
+            u8 *buf = (u8 *)_socketMsgScratch(stackbuf, &heapbuf, &heapsize, len);
+            if(buf == NULL) {
+                errno = ENOMEM;
+                ret = -1;
+                break;
+            }
+
+            data = buf;
+            for(int j = 0; j < msg->msg_iovlen; j++) {
+                memcpy(buf, msg->msg_iov[j].iov_base, msg->msg_iov[j].iov_len);
+                buf += msg->msg_iov[j].iov_len;
+            }
+        }
+
+        if(msg->msg_name != NULL)
+            ret = bsdSendTo(sockfd, data, len, flags, (const struct sockaddr *)msg->msg_name, msg->msg_namelen);
+        else
+            ret = bsdSend(sockfd, data, len, flags);
+
+        ret = _socketParseBsdResult(NULL, (int)ret);
+        if(ret == -1)
+            break;
+
+        msgvec[i].msg_len = ret;
+    }
+
+    free(heapbuf);
+
+    // Like Linux, only report the error when nothing was sent.
+    return i == 0 && ret == -1 ? -1 : (int)i;
 }
+
 int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
-    //TODO: do the necessary RE & implement it
-    errno = ENOSYS;
-    return -1;
+    u8 stackbuf[SOCKET_MSG_STACK_BUF_SIZE];
+    u8 *heapbuf = NULL;
+    size_t heapsize = 0;
+    unsigned int i;
+    ssize_t ret = 0;
+    u64 start = 0, timeout_ticks = 0;
+
+    if(msgvec == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    sockfd = _socketGetFd(sockfd);
+    if(sockfd == -1)
+        return -1;
+
+    if(timeout != NULL) {
+        if(timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        start = svcGetSystemTick();
+        timeout_ticks = timeout->tv_sec * 19200000ULL + timeout->tv_nsec * 12ULL / 625; // 19.2 MHz
+    }
+
+    for(i = 0; i < vlen; i++) {
+        struct msghdr *msg = &msgvec[i].msg_hdr;
+        ssize_t len = _socketIovecSize(msg->msg_iov, msg->msg_iovlen);
+        socklen_t *addrlen = msg->msg_name != NULL ? &msg->msg_namelen : NULL;
+        u8 *buf = NULL;
+
+        if(len == -1) {
+            errno = EINVAL;
+            ret = -1;
+            break;
+        }
+
+        if(msg->msg_iovlen == 1)
+            buf = (u8 *)msg->msg_iov[0].iov_base;
+        else if(msg->msg_iovlen > 1) {
+            buf = (u8 *)_socketMsgScratch(stackbuf, &heapbuf, &heapsize, len);
+            if(buf == NULL) {
+                errno = ENOMEM;
+                ret = -1;
+                break;
+            }
+        }
+
+        ret = bsdRecvFrom(sockfd, buf, len, flags & ~MSG_WAITFORONE, (struct sockaddr *)msg->msg_name, addrlen);
+        ret = _socketParseBsdResult(NULL, (int)ret);
+        if(ret == -1)
+            break;
+
+        if(msg->msg_iovlen > 1) {
+            size_t pos = 0;
+            for(int j = 0; j < msg->msg_iovlen && pos < (size_t)ret; j++) {
+                size_t chunk = (size_t)ret - pos < msg->msg_iov[j].iov_len ? (size_t)ret - pos : msg->msg_iov[j].iov_len;
+                memcpy(msg->msg_iov[j].iov_base, buf + pos, chunk);
+                pos += chunk;
+            }
+        }
+
+        // Ancillary data isn't supported.
+        msg->msg_controllen = 0;
+        msg->msg_flags = 0;
+        msgvec[i].msg_len = ret;
+
+        if(flags & MSG_WAITFORONE)
+            flags |= MSG_DONTWAIT;
+
+        // Like Linux, the timeout is only checked after each datagram.
+        if(timeout != NULL && svcGetSystemTick() - start >= timeout_ticks) {
+            i++;
+            break;
+        }
+    }
+
+    free(heapbuf);
+
+    return i == 0 && ret == -1 ? -1 : (int)i;
 }
 
 /***********************************************************************************************************************/
@@ -1493,28 +1980,32 @@ const char *gai_strerror(int err) {
     return buf;
 }
 
-int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res) {
+// Queries sfdnsres. On success, *out_serialized receives the serialized result list, trimmed to *out_size bytes.
+static int _socketGetAddrInfoUncached(const char *node, const char *service, const struct addrinfo *hints,
+                                      struct addrinfo_serialized_hdr **out_serialized, size_t *out_size) {
     int gaie = 0;
     Result rc = 0;
     size_t hints_sz;
     struct addrinfo_serialized_hdr *hints_serialized = _socketSerializeAddrInfoList(&hints_sz, hints);
-    struct addrinfo_serialized_hdr *out_serialized = NULL;
-    struct addrinfo *out = NULL;
+    struct addrinfo_serialized_hdr *out_serialized_ = NULL;
     SfdnsresRequestResults ret;
 
+    *out_serialized = NULL;
+    *out_size = 0;
+
     if(hints_serialized == NULL) {
         gaie = EAI_MEMORY;
         goto cleanup;
     }
 
-    out_serialized = (struct addrinfo_serialized_hdr *)malloc(g_sfdnsresConfig.serialized_out_addrinfos_max_size);
+    out_serialized_ = (struct addrinfo_serialized_hdr *)malloc(g_sfdnsresConfig.serialized_out_addrinfos_max_size);
 
-    if(out_serialized == NULL) {
+    if(out_serialized_ == NULL) {
         gaie = EAI_MEMORY;
         goto cleanup;
     }
 
-    rc = sfdnsresGetAddrInfo(&ret, &g_sfdnsresConfig, node, service, hints_serialized, hints_sz, out_serialized);
+    rc = sfdnsresGetAddrInfo(&ret, &g_sfdnsresConfig, node, service, hints_serialized, hints_sz, out_serialized_);
 
     if(rc == 0xD401) {
         gaie = EAI_SYSTEM;
@@ -1537,18 +2028,384 @@ int getaddrinfo(const char *node, const char *service, const struct addrinfo *hi
         goto cleanup;
     }
 
-    out = _socketDeserializeAddrInfoList(out_serialized);
-    if(out == NULL)
+    // Only keep what's used, up to and including the terminating magic.
+    struct addrinfo_serialized_hdr *hdr = out_serialized_;
+    size_t size = 0;
+    while(size + sizeof(struct addrinfo_serialized_hdr) <= g_sfdnsresConfig.serialized_out_addrinfos_max_size && hdr->magic == htonl(0xBEEFCAFE)) {
+        size_t subsize1 = hdr->ai_addrlen == 0 ? 4 : ntohl(hdr->ai_addrlen);
+        size_t subsize2 = strlen((const char *)hdr + sizeof(struct addrinfo_serialized_hdr) + subsize1) + 1;
+        size += sizeof(struct addrinfo_serialized_hdr) + subsize1 + subsize2;
+        hdr = (struct addrinfo_serialized_hdr *)((u8 *)out_serialized_ + size);
+    }
+
+    *out_serialized = (struct addrinfo_serialized_hdr *)malloc(size + sizeof(u32));
+    if(*out_serialized == NULL) {
         gaie = EAI_MEMORY;
+        goto cleanup;
+    }
+
+    memcpy(*out_serialized, out_serialized_, size);
+    *(u32 *)((u8 *)*out_serialized + size) = 0;
+    *out_size = size + sizeof(u32);
+
 cleanup:
-    *res = out;
     free(hints_serialized);
-    free(out_serialized);
+    free(out_serialized_);
     g_sfdnsresResult = rc;
 
     return gaie;
 }
 
+/*
+    getaddrinfo results are cached, keyed by (node, service, hints). sfdnsres doesn't report the record TTLs,
+    so entries expire after a configurable time instead. Failures other than EAI_NONAME aren't cached.
+    Concurrent lookups of the same key are coalesced: later callers wait for the pending entry to complete.
+*/
+#define SOCKET_DNS_CACHE_SIZE 32
+
+typedef struct {
+    bool used;
+    bool pending;
+    u32 waiters;
+    char *node;
+    char *service;
+    bool has_hints;
+    int hints_flags, hints_family, hints_socktype, hints_protocol;
+    int gaie;
+    int errno_;
+    struct addrinfo_serialized_hdr *serialized;
+    u64 expiry;
+    u64 last_used;
+} socket_dns_entry_t;
+
+static Mutex g_socketDnsMutex;
+static CondVar g_socketDnsCond = { 0, &g_socketDnsMutex };
+static socket_dns_entry_t g_socketDnsCache[SOCKET_DNS_CACHE_SIZE];
+static u64 g_socketDnsPositiveTtl = 60 * 19200000ULL;
+static u64 g_socketDnsNegativeTtl = 10 * 19200000ULL;
+
+static bool _socketDnsStrEqual(const char *a, const char *b) {
+    return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
+}
+
+static bool _socketDnsKeyEqual(const socket_dns_entry_t *e, const char *node, const char *service, const struct addrinfo *hints) {
+    if(!_socketDnsStrEqual(e->node, node) || !_socketDnsStrEqual(e->service, service) || e->has_hints != (hints != NULL))
+        return false;
+
+    return hints == NULL || (e->hints_flags == hints->ai_flags && e->hints_family == hints->ai_family &&
+                             e->hints_socktype == hints->ai_socktype && e->hints_protocol == hints->ai_protocol);
+}
+
+static void _socketDnsEntryClear(socket_dns_entry_t *e) {
+    free(e->node);
+    free(e->service);
+    free(e->serialized);
+    memset(e, 0, sizeof(*e));
+}
+
+// Picks a free entry, or evicts the least recently used completed one. Returns NULL when all entries are busy.
+static socket_dns_entry_t *_socketDnsEntryAlloc(void) {
+    socket_dns_entry_t *victim = NULL;
+
+    for(int i = 0; i < SOCKET_DNS_CACHE_SIZE; i++) {
+        socket_dns_entry_t *e = &g_socketDnsCache[i];
+        if(!e->used)
+            return e;
+        if(!e->pending && e->waiters == 0 && (victim == NULL || e->last_used < victim->last_used))
+            victim = e;
+    }
+
+    if(victim != NULL)
+        _socketDnsEntryClear(victim);
+    return victim;
+}
+
+// Returns the result of a completed entry to a caller. Must be called with the mutex held.
+static int _socketDnsEntryResult(const socket_dns_entry_t *e, struct addrinfo **res) {
+    if(e->gaie != 0) {
+        if(e->gaie == EAI_SYSTEM)
+            errno = e->errno_;
+        return e->gaie;
+    }
+
+    *res = _socketDeserializeAddrInfoList(e->serialized);
+    return *res == NULL ? EAI_MEMORY : 0;
+}
+
+int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res) {
+    struct addrinfo_serialized_hdr *serialized = NULL;
+    socket_dns_entry_t *e = NULL;
+    size_t size;
+    int gaie;
+
+    *res = NULL;
+
+    mutexLock(&g_socketDnsMutex);
+
+    // Read once, so that an entry can't expire between the checks below.
+    u64 now = svcGetSystemTick();
+
+    for(int i = 0; i < SOCKET_DNS_CACHE_SIZE; i++) {
+        socket_dns_entry_t *it = &g_socketDnsCache[i];
+        if(!it->used || !_socketDnsKeyEqual(it, node, service, hints))
+            continue;
+
+        // A stale result which still has waiters is theirs until the last one clears it: look up into another entry.
+        if(!it->pending && it->waiters != 0 && now >= it->expiry)
+            continue;
+
+        e = it;
+        break;
+    }
+
+    if(e != NULL && e->pending) {
+        e->waiters++;
+        while(e->pending)
+            condvarWait(&g_socketDnsCond);
+        e->waiters--;
+
+        // The result of the lookup we waited for is used even if it isn't cached.
+        e->last_used = svcGetSystemTick();
+        gaie = _socketDnsEntryResult(e, res);
+        if(e->waiters == 0 && e->expiry <= e->last_used)
+            _socketDnsEntryClear(e);
+        mutexUnlock(&g_socketDnsMutex);
+        g_sfdnsresResult = 0;
+        return gaie;
+    }
+
+    if(e != NULL && now < e->expiry) {
+        e->last_used = now;
+        gaie = _socketDnsEntryResult(e, res);
+        mutexUnlock(&g_socketDnsMutex);
+        g_sfdnsresResult = 0;
+        return gaie;
+    }
+
+    if(e != NULL)
+        _socketDnsEntryClear(e);
+    else
+        e = _socketDnsEntryAlloc();
+
+    if(e != NULL) {
+        e->node = node != NULL ? strdup(node) : NULL;
+        e->service = service != NULL ? strdup(service) : NULL;
+        if((node != NULL && e->node == NULL) || (service != NULL && e->service == NULL)) {
+            _socketDnsEntryClear(e);
+            e = NULL;
+        }
+    }
+
+    if(e != NULL) {
+        e->used = true;
+        e->pending = true;
+        e->has_hints = hints != NULL;
+        if(hints != NULL) {
+            e->hints_flags = hints->ai_flags;
+            e->hints_family = hints->ai_family;
+            e->hints_socktype = hints->ai_socktype;
+            e->hints_protocol = hints->ai_protocol;
+        }
+    }
+
+    mutexUnlock(&g_socketDnsMutex);
+
+    gaie = _socketGetAddrInfoUncached(node, service, hints, &serialized, &size);
+    if(gaie == 0) {
+        *res = _socketDeserializeAddrInfoList(serialized);
+        if(*res == NULL)
+            gaie = EAI_MEMORY;
+    }
+
+    // The cache is full of pending lookups: nothing to store the result into.
+    if(e == NULL) {
+        free(serialized);
+        return gaie;
+    }
+
+    mutexLock(&g_socketDnsMutex);
+
+    e->pending = false;
+    e->gaie = gaie;
+    e->errno_ = errno;
+    e->serialized = serialized;
+    e->last_used = svcGetSystemTick();
+    if(gaie == 0)
+        e->expiry = e->last_used + g_socketDnsPositiveTtl;
+    else if(gaie == EAI_NONAME)
+        e->expiry = e->last_used + g_socketDnsNegativeTtl;
+    else
+        e->expiry = 0;
+
+    if(e->waiters != 0)
+        condvarWakeAll(&g_socketDnsCond);
+    else if(e->expiry <= e->last_used)
+        _socketDnsEntryClear(e);
+
+    mutexUnlock(&g_socketDnsMutex);
+
+    return gaie;
+}
+
+void socketSetDnsCacheTtl(u32 positive_ms, u32 negative_ms) {
+    mutexLock(&g_socketDnsMutex);
+    g_socketDnsPositiveTtl = positive_ms * 19200ULL;
+    g_socketDnsNegativeTtl = negative_ms * 19200ULL;
+    mutexUnlock(&g_socketDnsMutex);
+}
+
+void socketClearDnsCache(void) {
+    mutexLock(&g_socketDnsMutex);
+    for(int i = 0; i < SOCKET_DNS_CACHE_SIZE; i++) {
+        socket_dns_entry_t *e = &g_socketDnsCache[i];
+        if(!e->used)
+            continue;
+
+        // Lookups in progress are left alone, entries which still have waiters are cleared by the last one.
+        if(e->pending)
+            continue;
+        else if(e->waiters != 0)
+            e->expiry = 0;
+        else
+            _socketDnsEntryClear(e);
+    }
+    mutexUnlock(&g_socketDnsMutex);
+}
+
+typedef struct socket_dns_request_s {
+    struct socket_dns_request_s *next;
+    char *node;
+    char *service;
+    bool has_hints;
+    struct addrinfo hints;
+    SocketDnsCallback callback;
+    void *userdata;
+} socket_dns_request_t;
+
+static Mutex g_socketDnsQueueMutex;
+static CondVar g_socketDnsQueueCond = { 0, &g_socketDnsQueueMutex };
+static socket_dns_request_t *g_socketDnsQueueHead, *g_socketDnsQueueTail;
+static Thread g_socketDnsThread;
+static bool g_socketDnsThreadRunning;
+static bool g_socketDnsThreadExit;
+
+static void _socketDnsRequestFree(socket_dns_request_t *req) {
+    free(req->node);
+    free(req->service);
+    free(req);
+}
+
+static void _socketDnsWorker(void *arg) {
+    (void)arg;
+
+    for(;;) {
+        socket_dns_request_t *req;
+
+        mutexLock(&g_socketDnsQueueMutex);
+        while(g_socketDnsQueueHead == NULL && !g_socketDnsThreadExit)
+            condvarWait(&g_socketDnsQueueCond);
+
+        req = g_socketDnsQueueHead;
+        if(req != NULL) {
+            g_socketDnsQueueHead = req->next;
+            if(g_socketDnsQueueHead == NULL)
+                g_socketDnsQueueTail = NULL;
+        }
+        mutexUnlock(&g_socketDnsQueueMutex);
+
+        if(req == NULL)
+            break;
+
+        // Requests still queued on exit are completed with EAI_AGAIN.
+        struct addrinfo *res = NULL;
+        int gaie = g_socketDnsThreadExit ? EAI_AGAIN : getaddrinfo(req->node, req->service, req->has_hints ? &req->hints : NULL, &res);
+
+        req->callback(gaie, res, req->userdata);
+        _socketDnsRequestFree(req);
+    }
+}
+
+int socketGetAddrInfoAsync(const char *node, const char *service, const struct addrinfo *hints, SocketDnsCallback callback, void *userdata) {
+    socket_dns_request_t *req;
+    int gaie = 0;
+
+    if(callback == NULL) {
+        errno = EINVAL;
+        return EAI_SYSTEM;
+    }
+
+    req = (socket_dns_request_t *)calloc(1, sizeof(socket_dns_request_t));
+    if(req == NULL)
+        return EAI_MEMORY;
+
+    req->node = node != NULL ? strdup(node) : NULL;
+    req->service = service != NULL ? strdup(service) : NULL;
+    if((node != NULL && req->node == NULL) || (service != NULL && req->service == NULL)) {
+        _socketDnsRequestFree(req);
+        return EAI_MEMORY;
+    }
+
+    if(hints != NULL) {
+        req->has_hints = true;
+        req->hints.ai_flags = hints->ai_flags;
+        req->hints.ai_family = hints->ai_family;
+        req->hints.ai_socktype = hints->ai_socktype;
+        req->hints.ai_protocol = hints->ai_protocol;
+    }
+    req->callback = callback;
+    req->userdata = userdata;
+
+    mutexLock(&g_socketDnsQueueMutex);
+
+    if(!g_socketDnsThreadRunning) {
+        g_socketDnsThreadExit = false;
+        if(R_SUCCEEDED(threadCreate(&g_socketDnsThread, _socketDnsWorker, NULL, 0x4000, 0x2C, -2))) {
+            if(R_SUCCEEDED(threadStart(&g_socketDnsThread)))
+                g_socketDnsThreadRunning = true;
+            else
+                threadClose(&g_socketDnsThread);
+        }
+    }
+
+    if(g_socketDnsThreadRunning && !g_socketDnsThreadExit) {
+        if(g_socketDnsQueueTail != NULL)
+            g_socketDnsQueueTail->next = req;
+        else
+            g_socketDnsQueueHead = req;
+        g_socketDnsQueueTail = req;
+        condvarWakeOne(&g_socketDnsQueueCond);
+    }
+    else {
+        errno = ENOMEM;
+        gaie = EAI_SYSTEM;
+    }
+
+    mutexUnlock(&g_socketDnsQueueMutex);
+
+    if(gaie != 0)
+        _socketDnsRequestFree(req);
+    return gaie;
+}
+
+// Stops the resolver thread, completing the queued requests with EAI_AGAIN.
+static void _socketDnsWorkerExit(void) {
+    mutexLock(&g_socketDnsQueueMutex);
+    bool running = g_socketDnsThreadRunning;
+    g_socketDnsThreadExit = true;
+    condvarWakeAll(&g_socketDnsQueueCond);
+    mutexUnlock(&g_socketDnsQueueMutex);
+
+    if(!running)
+        return;
+
+    threadWaitForExit(&g_socketDnsThread);
+    threadClose(&g_socketDnsThread);
+
+    mutexLock(&g_socketDnsQueueMutex);
+    g_socketDnsThreadRunning = false;
+    mutexUnlock(&g_socketDnsQueueMutex);
+}
+
 int getnameinfo(const struct sockaddr *sa, socklen_t salen,
                 char *host, socklen_t hostlen,
                 char *serv, socklen_t servlen,
@@ -398,10 +398,10 @@ int bsdSysctl(const int *name, unsigned int namelen, void *oldp, size_t *oldlenp
     return ret;
 }
 
-ssize_t bsdRecv(int sockfd, void *buf, size_t len, int flags) {
+static ssize_t _bsdRecv(int sockfd, void *buf, size_t len, int flags, size_t ipc_buffer_size) {
     IpcCommand c;
     ipcInitialize(&c);
-    ipcAddRecvSmart(&c, g_bsdSrvIpcBufferSize, buf, len, 0);
+    ipcAddRecvSmart(&c, ipc_buffer_size, buf, len, 0);
 
     struct {
         u64 magic;
@@ -420,6 +420,14 @@ ssize_t bsdRecv(int sockfd, void *buf, size_t len, int flags) {
     return _bsdDispatchBasicCommand(&c, NULL);
 }
 
+ssize_t bsdRecv(int sockfd, void *buf, size_t len, int flags) {
+    return _bsdRecv(sockfd, buf, len, flags, g_bsdSrvIpcBufferSize);
+}
+
+ssize_t bsdRecvMapped(int sockfd, void *buf, size_t len, int flags) {
+    return _bsdRecv(sockfd, buf, len, flags, 0);
+}
+
 ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen){
     IpcCommand c;
     socklen_t inaddrlen = addrlen == NULL ? 0 : *addrlen;
@@ -446,10 +454,10 @@ ssize_t bsdRecvFrom(int sockfd, void *buf, size_t len, int flags, struct sockadd
     return _bsdDispatchCommandWithOutAddrlen(&c, addrlen);
 }
 
-ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags) {
+static ssize_t _bsdSend(int sockfd, const void* buf, size_t len, int flags, size_t ipc_buffer_size) {
     IpcCommand c;
     ipcInitialize(&c);
-    ipcAddSendSmart(&c, g_bsdSrvIpcBufferSize, buf, len, 0);
+    ipcAddSendSmart(&c, ipc_buffer_size, buf, len, 0);
 
     struct {
         u64 magic;
@@ -468,6 +476,14 @@ ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags) {
     return _bsdDispatchBasicCommand(&c, NULL);
 }
 
+ssize_t bsdSend(int sockfd, const void* buf, size_t len, int flags) {
+    return _bsdSend(sockfd, buf, len, flags, g_bsdSrvIpcBufferSize);
+}
+
+ssize_t bsdSendMapped(int sockfd, const void* buf, size_t len, int flags) {
+    return _bsdSend(sockfd, buf, len, flags, 0);
+}
+
 ssize_t bsdSendTo(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) {
     IpcCommand c;
     ipcInitialize(&c);
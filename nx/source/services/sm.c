@@ -144,6 +144,9 @@ Result smGetService(Service* service_out, const char* name)
         }
     }
 
+    if (R_SUCCEEDED(rc))
+        ipcTraceSetSessionName(handle, name_encoded);
+
     return rc;
 }
 